@@ -70,7 +70,7 @@ mp_encode_sub() {
     	((hit_end=hit_end | status))
     done
     #echo "subcatstring is ${subcatstring}"
-    cat ${subcatstring} > saved${id}.dsv
+    ${dsv_executable} j -y -out=saved${id}.dsv ${subcatstring}
     rm ${subcatstring}
 }
 
@@ -94,7 +94,7 @@ mp_encode() {
         fi
     done
     echo "catstring is ${catstring}"
-    cat ${catstring} > $outputfile
+    ${dsv_executable} j -y -out=$outputfile ${catstring}
     rm ${catstring}
 }
 
@@ -47,7 +47,7 @@ mp_encode_sub() {
         ((hit_end=hit_end | status))
     done
     #echo "subcatstring is ${subcatstring}"
-    cat ${subcatstring} > saved${id}.dsv
+    ${dsv_executable} j -y -out=saved${id}.dsv ${subcatstring}
     rm ${subcatstring}
 }
 
@@ -71,7 +71,7 @@ mp_encode() {
         fi
     done
    # echo "catstring is ${catstring}"
-    cat ${catstring} > saved.dsv
+    ${dsv_executable} j -y -out=saved.dsv ${catstring}
     rm ${catstring}
 }
 
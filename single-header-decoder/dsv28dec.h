@@ -116,6 +116,10 @@ extern "C" {
  *    }
  * }
  * d28_dec_free
+ *
+ * Every DSV_DECODER owns all of its scratch memory, so independent decoders
+ * do not share any mutable state (other than the log level and the
+ * _DSV2_MEMORY_STATS_ counters, which are global).
  */
 
 /******************************************************************************/
@@ -153,6 +157,8 @@ extern "C" {
 #define DSV_PT_META 0x00
 #define DSV_PT_PIC  0x04
 #define DSV_PT_EOS  0x10
+/* encoder side index, not needed for decoding */
+#define DSV_PT_TRAILER 0x08
 
 #define DSV_PT_IS_PIC(x)   ((x) & DSV_PT_PIC)
 #define DSV_PT_IS_REF(x)  (((x) & 0x6) == 0x6)
@@ -239,10 +245,20 @@ typedef struct {
     int refcount;
 } DSV_IMAGE;
 
+typedef struct {
+    int32_t *data;
+    int size; /* in number of coefficients */
+} DSV_SBT_SCRATCH; /* subband transform scratch, owned by a decoder */
+
 typedef struct {
     DSV_META vidmeta;
     DSV_IMAGE *ref;
+    /* set by user, packet buffers passed to d28_dec are not freed by it.
+     * allows decoding straight out of memory the decoder doesn't own */
+    int keep_buffers;
     int got_metadata;
+
+    DSV_SBT_SCRATCH sbt_scratch;
 } DSV_DECODER;
 
 typedef struct {
@@ -276,6 +292,10 @@ extern void d28_dec_free(DSV_DECODER *d);
 #define DSV_GET_LINE(p, y) ((p)->data + (y) * (p)->stride)
 #define DSV_GET_XY(p, x, y) ((p)->data + (x) + (y) * (p)->stride)
 
+/* pixels of padding around every plane of a frame made with a border
+ * (DSV_MAX_BLOCK_SIZE) */
+#define DSV_FRAME_BORDER 32
+
 extern DSV_FRAME *d28_mk_frame(int format, int width, int height, int border);
 
 extern DSV_FRAME *d28_frame_ref_inc(DSV_FRAME *frame);
@@ -399,7 +419,14 @@ extern int d28_get_log_level(void);
 #define DSV_FORMAT_H_SHIFT(format) (((format) >> 2) & 0x3)
 #define DSV_FORMAT_V_SHIFT(format) ((format) & 0x3)
 
-/* subband coefs */
+/* subband coefs
+ *
+ * these need the full 32 bits. the Haar LL band grows by 4x per level and
+ * only the top few levels are halved for overflow safety, so the DC of a
+ * flat white luma plane reaches ~5.2e7 at 1920x1080 and ~2.1e8 at
+ * 3840x2160. every level shares one plane, so a narrower type cannot be
+ * used even for the high frequency bands without changing the layout.
+ */
 typedef int32_t DSV_SBC;
 typedef struct {
     DSV_SBC *data;
@@ -474,19 +501,20 @@ typedef struct {
 #define DSV_SUB_EPRM 4 /* expanded prediction range mode */
 #define DSV_SUB_NSUB 5
 
-#define DSV_FRAME_BORDER DSV_MAX_BLOCK_SIZE
-
 typedef struct {
     DSV_PARAMS *params;
     uint8_t *blockdata; /* block bitmasks for adaptive things */
     uint8_t cur_plane;
     uint8_t isP; /* is P frame */
     DSV_FNUM fnum;
+    DSV_SBT_SCRATCH *scratch;
 } DSV_FMETA; /* frame metadata */
 
 typedef struct {
     uint8_t *start;
     unsigned pos;
+    unsigned end; /* readable size in bytes */
+    int err; /* sticky, set when a read went past 'end' */
 } DSV_BS;
 
 /* macros for really simple operations */
@@ -494,6 +522,7 @@ typedef struct {
 #define bs_ptr(bs) ((bs)->pos / 8)
 #define bs_set(bs, ptr) ((bs)->pos = (ptr) * 8)
 #define bs_skip(bs, n_bytes) ((bs)->pos += (n_bytes) * 8)
+#define bs_error(bs) ((bs)->err)
 
 typedef struct {
     DSV_BS bs;
@@ -849,8 +878,25 @@ bs_init(DSV_BS *bs, uint8_t *buffer)
 {
     bs->start = buffer;
     bs->pos = 0;
+    bs->end = UINT_MAX;
+    bs->err = 0;
+}
+
+/* reader that will not read past 'len' bytes of 'buffer' */
+static void
+bs_init_read(DSV_BS *bs, uint8_t *buffer, unsigned len)
+{
+    bs_init(bs, buffer);
+    bs->end = len;
 }
 
+/* reads never touch memory past 'end'. instead the reader pretends the
+ * data continues as one bits (so unary prefixes terminate) and sets a
+ * sticky error flag that the caller checks once per section.
+ * the check is made once per field or once per byte, never per bit. */
+#define BS_OVERRUN(bs, ptr, nbytes) \
+    ((ptr) >= (bs)->end || (nbytes) > (bs)->end - (ptr))
+
 static void
 bs_align(DSV_BS *bs)
 {
@@ -865,38 +911,91 @@ bs_get_bit(DSV_BS *bs)
 {
     unsigned out;
 
+    if (bs_ptr(bs) >= bs->end) {
+        bs->err = 1;
+        bs->pos++;
+        return 1;
+    }
     out = bs->start[bs_ptr(bs)] >> (7 - (bs->pos & 7));
     bs->pos++;
 
     return out & 1;
 }
 
+/* multi-bit reads work on a whole 32-bit word at once. a field of up to
+ * 24 bits plus the (at most 7 bit) offset into the first byte always fits,
+ * longer fields are split in two. only the bytes the field covers are read. */
+#define BS_WORD_BITS 24
+
 static unsigned
 bs_get_bits(DSV_BS *bs, unsigned n)
 {
-    unsigned rem, bit, out = 0;
+    uint8_t *p;
+    unsigned off, end, out;
+    uint32_t w;
 
-    while (n > 0) {
-        rem = 8 - (bs->pos & 7);
-        rem = MIN(n, rem);
-        bit = (7 - (bs->pos & 7)) - rem + 1;
-        out <<= rem;
-        out |= (bs->start[bs_ptr(bs)] & (((1 << rem) - 1) << bit)) >> bit;
-        n -= rem;
-        bs->pos += rem;
+    if (n > BS_WORD_BITS) {
+        out = bs_get_bits(bs, n - BS_WORD_BITS) << BS_WORD_BITS;
+        return out | bs_get_bits(bs, BS_WORD_BITS);
+    }
+    if (n == 0) {
+        return 0;
+    }
+    off = bs->pos & 7;
+    end = off + n;
+    if (BS_OVERRUN(bs, bs_ptr(bs), (end + 7) >> 3)) {
+        bs->err = 1;
+        bs->pos += n;
+        return 0;
     }
+    p = bs->start + bs_ptr(bs);
+    w = (uint32_t) p[0] << 24;
+    if (end > 8) {
+        w |= (uint32_t) p[1] << 16;
+        if (end > 16) {
+            w |= (uint32_t) p[2] << 8;
+            if (end > 24) {
+                w |= p[3];
+            }
+        }
+    }
+    bs->pos += n;
+    out = (w << off) >> (32 - n);
     return out;
 }
 
+/* the variable length readers walk a local copy of the current byte
+ * rather than re-indexing the buffer for every bit */
+#define BS_CACHE_LOAD(bs, idx) \
+    ((idx) < (bs)->end ? (bs)->start[(idx)] : ((bs)->err = 1, 0xff))
+
+#define BS_CACHE_BEGIN(bs, idx, cache, avail) \
+    do { \
+        (idx) = bs_ptr(bs); \
+        (avail) = 8 - ((bs)->pos & 7); \
+        (cache) = BS_CACHE_LOAD(bs, idx) & ((1U << (avail)) - 1); \
+        (idx)++; \
+    } while (0)
+
+#define BS_CACHE_END(bs, idx, avail) \
+    ((bs)->pos = (idx) * 8 - (avail))
+
+#define BS_CACHE_BIT(bs, idx, cache, avail) \
+    ((avail) == 0 ? ((cache) = BS_CACHE_LOAD(bs, idx), (idx)++, (avail) = 7, ((cache) >> 7) & 1) : \
+                    (((cache) >> --(avail)) & 1))
+
 /* B. Encoding Type: unsigned interleaved exp-Golomb code (UEG) */
 static unsigned
 bs_get_ueg(DSV_BS *bs)
 {
+    unsigned idx, cache, avail;
     unsigned v = 1;
 
-    while (!bs_get_bit(bs)) {
-        v = (v << 1) | bs_get_bit(bs);
+    BS_CACHE_BEGIN(bs, idx, cache, avail);
+    while (!BS_CACHE_BIT(bs, idx, cache, avail)) {
+        v = (v << 1) | BS_CACHE_BIT(bs, idx, cache, avail);
     }
+    BS_CACHE_END(bs, idx, avail);
     return v - 1;
 }
 
@@ -931,10 +1030,23 @@ static unsigned
 bs_get_rice(DSV_BS *bs, int *rk, int damp)
 {
     int k = (*rk) >> damp;
+    unsigned idx, cache, avail;
     unsigned q = 0;
-    while (!bs_get_bit(bs)) {
+
+    BS_CACHE_BEGIN(bs, idx, cache, avail);
+    /* unary prefix, whole zero bytes are skipped at once */
+    while (cache == 0) {
+        q += avail;
+        cache = BS_CACHE_LOAD(bs, idx);
+        idx++;
+        avail = 8;
+    }
+    while (!((cache >> (avail - 1)) & 1)) {
+        avail--;
         q++;
     }
+    avail--; /* terminating one */
+    BS_CACHE_END(bs, idx, avail);
     if (q) {
         (*rk)++;
     } else if ((*rk) > 0) {
@@ -1329,25 +1441,33 @@ d28_extend_frame(DSV_FRAME *frame)
 #define INV_SCALE40(x) ((x) / 4)
 #define INV_SCALENONE(x) (x)
 
-static DSV_SBC *temp_buf = NULL;
-static int temp_bufsz = 0;
-
-static void
-alloc_temp(int size)
+static DSV_SBC *
+alloc_temp(DSV_SBT_SCRATCH *s, int size)
 {
-    if (temp_bufsz < size) {
-        temp_bufsz = size;
+    if (s->size < size) {
+        s->size = size;
 
-        if (temp_buf) {
-            d28_free(temp_buf);
-            temp_buf = NULL;
+        if (s->data) {
+            d28_free(s->data);
+            s->data = NULL;
         }
 
-        temp_buf = (DSV_SBC*) d28_alloc(temp_bufsz * sizeof(DSV_SBC));
-        if (temp_buf == NULL) {
+        s->data = (DSV_SBC*) d28_alloc(s->size * sizeof(DSV_SBC));
+        if (s->data == NULL) {
             DSV_ERROR(("out of memory"));
         }
     }
+    return s->data;
+}
+
+static void
+free_temp(DSV_SBT_SCRATCH *s)
+{
+    if (s->data) {
+        d28_free(s->data);
+        s->data = NULL;
+    }
+    s->size = 0;
 }
 
 static void
@@ -1361,6 +1481,41 @@ cpysub(DSV_SBC *dst, DSV_SBC *src, unsigned w, unsigned h, unsigned stride)
     }
 }
 
+/* vertical passes are run over strips of this many adjacent columns
+ * (one 64 byte cache line of coefficients). each strip is gathered into
+ * contiguous lines so the column filters read sequential memory rather
+ * than touching a new cache line for every sample */
+#define STRIP_W 16
+
+/* plane sized scratch followed by the two strip buffers */
+#define SCRATCH_SIZE(w, h) (((w) + 2) * ((h) + 2) + 2 * STRIP_W * (h))
+
+static void
+get_strip(DSV_SBC *strip, DSV_SBC *src, int nc, int n, int stride)
+{
+    int x, y;
+
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < nc; x++) {
+            strip[x * n + y] = src[x];
+        }
+        src += stride;
+    }
+}
+
+static void
+put_strip(DSV_SBC *dst, DSV_SBC *strip, int nc, int n, int stride)
+{
+    int x, y;
+
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < nc; x++) {
+            dst[x] = strip[x * n + y];
+        }
+        dst += stride;
+    }
+}
+
 /* C.3 Rounding Divisions */
 static int
 round2(int v)
@@ -1403,6 +1558,8 @@ reflect(int i, int n)
 
 /* reflected get */
 #define rg(x, s) reflect(x, (n - 1)) * s
+/* direct get, for taps known to lie inside the signal */
+#define dg(x, s) (x) * s
 
 #define UNSCALE_UNPACK(scaleL, scaleH, s)             \
   for (i = 0; i < even_n; i += 2) {                   \
@@ -1449,28 +1606,47 @@ reflect(int i, int n)
   }
 
 /* 5 tap low/high pass filters with/without adaptive ringing */
-#define MAKE_5_TAP(v, C0, CA, CS, op, s)            \
-  v[i * s] op (-v[rg(i - 3, s)] +                   \
+#define MAKE_5_TAP(v, C0, CA, CS, op, s, g)         \
+  v[i * s] op (-v[g(i - 3, s)] +                    \
           C0 * (v[(i - 1) * s] + v[(i + 1) * s]) -  \
-                v[rg(i + 3, s)] + CA) >> CS
+                v[g(i + 3, s)] + CA) >> CS
+
+/* only the outer taps can land outside the signal, so reflection
+ * is limited to the first and last few samples of the loop */
+#define DO_5_TAP_LO(v, C0, CA, CS, op, s)      \
+  v[0] op v[s] >> 1;                           \
+  for (i = 2; i < even_n && i < 4; i += 2) {   \
+      MAKE_5_TAP(v, C0, CA, CS, op, s, rg);    \
+  }                                            \
+  for (; i < n - 4; i += 2) {                  \
+      MAKE_5_TAP(v, C0, CA, CS, op, s, dg);    \
+  }                                            \
+  for (; i < even_n; i += 2) {                 \
+      MAKE_5_TAP(v, C0, CA, CS, op, s, rg);    \
+  }
 
-#define DO_5_TAP_LO(v, C0, CA, CS, op, s) \
-  v[0] op v[s] >> 1;                      \
-  for (i = 2; i < even_n; i += 2) {       \
-      MAKE_5_TAP(v, C0, CA, CS, op, s);   \
+#define ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, g)  \
+  {                                                       \
+      int bv = sb[(sbp >> DSV_BLOCK_INTERP_P) * sbs];     \
+      if (bv & DSV_IS_RINGING) {                          \
+          MAKE_5_TAP(v, R0, RA, RS, op, s, g);            \
+      } else {                                            \
+          MAKE_5_TAP(v, C0, CA, CS, op, s, g);            \
+      }                                                   \
+      sbp += delta;                                       \
   }
 
-#define DO_5_TAP_LO_A(v, C0, CA, CS, R0, RA, RS, op, s)             \
-  delta *= 2;                                                       \
-  v[0] op v[s] >> 1;                                                \
-  for (i = 2; i < even_n; i += 2) {                                 \
-      int bv = sb[(sbp >> DSV_BLOCK_INTERP_P) * sbs];               \
-      if (bv & DSV_IS_RINGING) {                                    \
-          MAKE_5_TAP(v, R0, RA, RS, op, s);                         \
-      } else {                                                      \
-          MAKE_5_TAP(v, C0, CA, CS, op, s);                         \
-      }                                                             \
-      sbp += delta;                                                 \
+#define DO_5_TAP_LO_A(v, C0, CA, CS, R0, RA, RS, op, s)       \
+  delta *= 2;                                                 \
+  v[0] op v[s] >> 1;                                          \
+  for (i = 2; i < even_n && i < 4; i += 2) {                  \
+      ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, rg);      \
+  }                                                           \
+  for (; i < n - 4; i += 2) {                                 \
+      ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, dg);      \
+  }                                                           \
+  for (; i < even_n; i += 2) {                                \
+      ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, rg);      \
   }
 
 static void
@@ -1552,13 +1728,21 @@ ifilterLOSSLESS(DSV_SBC *out, DSV_SBC *in, int n, int s)
     DO_SIMPLE_HI(out, +=, s);
 }
 
-#define inv_2d(tmp, in, fw, fh, lvl, ifilter) \
+#define inv_2d(tmp, strip, in, fw, fh, lvl, ifilter) \
 { \
-    int i, j, sw, sh; \
+    int i, j, k, nc, sw, sh; \
+    DSV_SBC *cin, *cout; \
     sw = DSV_ROUND_SHIFT(fw, lvl - 1); \
     sh = DSV_ROUND_SHIFT(fh, lvl - 1); \
-    for (i = 0; i < sw; i++) { \
-        ifilter(tmp + i, in + i, sh, fw); \
+    cin = strip; \
+    cout = strip + STRIP_W * sh; \
+    for (i = 0; i < sw; i += STRIP_W) { \
+        nc = MIN(STRIP_W, sw - i); \
+        get_strip(cin, in + i, nc, sh, fw); \
+        for (k = 0; k < nc; k++) { \
+            ifilter(cout + sh * k, cin + sh * k, sh, 1); \
+        } \
+        put_strip(tmp + i, cout, nc, sh, fw); \
     } \
     for (j = 0; j < sh; j++) { \
         ifilter(in + fw * j, tmp + fw * j, sw, 1); \
@@ -1566,9 +1750,10 @@ ifilterLOSSLESS(DSV_SBC *out, DSV_SBC *in, int n, int s)
 }
 
 static void
-inv_L2a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
+inv_L2a_2d(DSV_SBC *tmp, DSV_SBC *strip, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
 {
-    int i, j, bx = 0, by = 0, dbx, dby, w, h;
+    int i, j, k, nc, bx = 0, by = 0, dbx, dby, w, h;
+    DSV_SBC *cin, *cout;
     uint8_t *line;
 
     w = DSV_ROUND_SHIFT(sW, lvl - 1);
@@ -1576,10 +1761,17 @@ inv_L2a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
 
     dbx = (fm->params->nblocks_h << DSV_BLOCK_INTERP_P) / w;
     dby = (fm->params->nblocks_v << DSV_BLOCK_INTERP_P) / h;
-    for (i = 0; i < w; i++) {
-        line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
-        ifilterL2_a(tmp + i, in + i, h, sW, line, dby, fm->params->nblocks_h);
-        bx += dbx;
+    cin = strip;
+    cout = strip + STRIP_W * h;
+    for (i = 0; i < w; i += STRIP_W) {
+        nc = MIN(STRIP_W, w - i);
+        get_strip(cin, in + i, nc, h, sW);
+        for (k = 0; k < nc; k++) {
+            line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
+            ifilterL2_a(cout + h * k, cin + h * k, h, 1, line, dby, fm->params->nblocks_h);
+            bx += dbx;
+        }
+        put_strip(tmp + i, cout, nc, h, sW);
     }
     for (j = 0; j < h; j++) {
         line = fm->blockdata + (by >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
@@ -1808,14 +2000,15 @@ static void
 inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, DSV_FMETA *fm)
 {
     int w, h, lvls, l, hqp, ovf_safety;
-    DSV_SBC *temp_buf_pad;
+    DSV_SBC *scratch, *temp_buf_pad, *strip;
 
     w = src->width;
     h = src->height;
 
     lvls = nlevels(w, h);
-    alloc_temp((w + 2) * (h + 2));
-    temp_buf_pad = temp_buf + w;
+    scratch = alloc_temp(fm->scratch, SCRATCH_SIZE(w, h));
+    temp_buf_pad = scratch + w;
+    strip = scratch + (w + 2) * (h + 2);
 
     for (l = lvls; l > 0; l--) {
         hqp = (fm->cur_plane == 0) ? (q / (fm->isP ? 14 : (l > 4 ? 2 : 8))) : (q / 2);
@@ -1823,22 +2016,22 @@ inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, DSV_FMETA *fm)
 
         if (fm->params->lossless) {
             if ((l >= 1 && l <= (lvls - 2))) {
-                inv_2d(temp_buf_pad, src->data, w, h, l, ifilterLOSSLESS);
+                inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterLOSSLESS);
             } else {
                 inv_simple(src->data, temp_buf_pad, w, h, l, ovf_safety);
             }
             continue;
         }
         if (LLI_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterLLI);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterLLI);
         } else if (LLP_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterLLP);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterLLP);
         } else if (CC_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterCC);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterCC);
         } else if (L2A_CONDITION) {
-            inv_L2a_2d(temp_buf_pad, src->data, w, h, l, fm);
+            inv_L2a_2d(temp_buf_pad, strip, src->data, w, h, l, fm);
         } else if (L1_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterL1);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterL1);
         } else {
             if (fm->cur_plane == 0 || !fm->isP) {
                 inv(src->data, temp_buf_pad, w, h, l, hqp, ovf_safety);
@@ -2501,17 +2694,48 @@ chroma_filter(DSV_MV *vecs, int q, DSV_PARAMS *p, DSV_PLANE *dp)
     }
 }
 
+#define BF_SHIFT  (DSV_HP_SHF + 1)
+#define BF_MULADD (1 << DSV_HP_SHF)
+
+/* fold the selected half-pel filter and the linear blend for a given
+ * quarter-pel phase into one set of 4-tap weights so the interpolation
+ * loops below are a plain multiply-accumulate with no per-pixel branching.
+ *
+ * blend(f) for phase 0..3 is (2b, f + b, 2f, f + c) in units of BF_MULADD
+ * where f = sharp * (b + c) - soft * (a + d) */
+static void
+qp_taps(int *t, int dq, int phase)
+{
+    int sharp, soft, wf, wb, wc;
+
+    if (dq) {
+        sharp = DSV_HPF_A(0, 1, 0, 0);
+        soft = -DSV_HPF_A(1, 0, 0, 0);
+    } else {
+        sharp = DSV_HPF_B(0, 1, 0, 0);
+        soft = -DSV_HPF_B(1, 0, 0, 0);
+    }
+    wf = (phase & 1) ? 1 : (phase & 2);
+    wb = (phase == 0) ? 2 : (phase == 1);
+    wc = (phase == 3);
+
+    t[0] = -wf * soft;
+    t[1] = wf * sharp + BF_MULADD * wb;
+    t[2] = wf * sharp + BF_MULADD * wc;
+    t[3] = -wf * soft;
+}
+
 static void
 luma_qp(uint8_t *dec, int ds,
         uint8_t *ref, int rs,
         int bw, int bh,
         int dx, int dy, int tmc)
 {
-    static int16_t tbuf[(DSV_MAX_BLOCK_SIZE + 3) * DSV_MAX_BLOCK_SIZE];
+    int16_t tbuf[(DSV_MAX_BLOCK_SIZE + 3) * DSV_MAX_BLOCK_SIZE];
     int16_t *tmp;
-    int x, y, a, b, c, d, f, large_mv, dqtx, dqty;
-#define BF_SHIFT  (DSV_HP_SHF + 1)
-#define BF_MULADD (1 << DSV_HP_SHF)
+    int x, y, t0, t1, t2, t3, large_mv, dqtx, dqty;
+    int tx[4], ty[4];
+
     tmp = tbuf;
 
     large_mv = abs(dx) >= 8 || abs(dy) >= 8;
@@ -2529,64 +2753,41 @@ luma_qp(uint8_t *dec, int ds,
      * every frame which generally averages out to a better approximation over
      * longer subpel motion sequences.
      */
+    qp_taps(tx, dqtx, dx);
+    qp_taps(ty, dqty, dy);
+
+    t0 = tx[0];
+    t1 = tx[1];
+    t2 = tx[2];
+    t3 = tx[3];
     for (y = 0; y < bh + 3; y++) {
         for (x = 0; x < bw; x++) {
-            a = ref[x + 0];
-            b = ref[x + 1];
-            c = ref[x + 2];
-            d = ref[x + 3];
-            if (dqtx) {
-                f = DSV_HPF_A(a, b, c, d);
-            } else {
-                f = DSV_HPF_B(a, b, c, d);
-            }
-            /* linear blend */
-            switch (dx) {
-                case 0:
-                    tmp[x] = (BF_MULADD * 2 * b + BF_MULADD) >> BF_SHIFT;
-                    break;
-                case 1:
-                    tmp[x] = (f + BF_MULADD * b + BF_MULADD) >> BF_SHIFT;
-                    break;
-                case 2:
-                    tmp[x] = (f * 2 + BF_MULADD) >> BF_SHIFT;
-                    break;
-                case 3:
-                    tmp[x] = (f + BF_MULADD * c + BF_MULADD) >> BF_SHIFT;
-                    break;
-            }
+            tmp[x] = (t0 * ref[x + 0] +
+                      t1 * ref[x + 1] +
+                      t2 * ref[x + 2] +
+                      t3 * ref[x + 3] + BF_MULADD) >> BF_SHIFT;
         }
         tmp += DSV_MAX_BLOCK_SIZE;
         ref += rs;
     }
     tmp -= (bh + 3) * DSV_MAX_BLOCK_SIZE;
 
+    t0 = ty[0];
+    t1 = ty[1];
+    t2 = ty[2];
+    t3 = ty[3];
     for (y = 0; y < bh; y++) {
+        int16_t *r0, *r1, *r2, *r3;
+
+        r0 = tmp + 0 * DSV_MAX_BLOCK_SIZE;
+        r1 = tmp + 1 * DSV_MAX_BLOCK_SIZE;
+        r2 = tmp + 2 * DSV_MAX_BLOCK_SIZE;
+        r3 = tmp + 3 * DSV_MAX_BLOCK_SIZE;
         for (x = 0; x < bw; x++) {
-            a = tmp[x + 0 * DSV_MAX_BLOCK_SIZE];
-            b = tmp[x + 1 * DSV_MAX_BLOCK_SIZE];
-            c = tmp[x + 2 * DSV_MAX_BLOCK_SIZE];
-            d = tmp[x + 3 * DSV_MAX_BLOCK_SIZE];
-            if (dqty) {
-                f = DSV_HPF_A(a, b, c, d);
-            } else {
-                f = DSV_HPF_B(a, b, c, d);
-            }
-            /* linear blend */
-            switch (dy) {
-                case 0:
-                    dec[x] = clamp_u8((BF_MULADD * 2 * b + BF_MULADD) >> BF_SHIFT);
-                    break;
-                case 1:
-                    dec[x] = clamp_u8((f + BF_MULADD * b + BF_MULADD) >> BF_SHIFT);
-                    break;
-                case 2:
-                    dec[x] = clamp_u8((f * 2 + BF_MULADD) >> BF_SHIFT);
-                    break;
-                case 3:
-                    dec[x] = clamp_u8((f + BF_MULADD * c + BF_MULADD) >> BF_SHIFT);
-                    break;
-            }
+            dec[x] = clamp_u8((t0 * r0[x] +
+                               t1 * r1[x] +
+                               t2 * r2[x] +
+                               t3 * r3[x] + BF_MULADD) >> BF_SHIFT);
         }
         dec += ds;
         tmp += DSV_MAX_BLOCK_SIZE;
@@ -2614,6 +2815,35 @@ bilinear_sp(
     if (dx | dy) {
         int x, y, f0, f1, f2, f3, af, sf;
 
+        /* one-dimensional offsets reduce exactly to a two-tap filter
+         * since the unused direction's weight is a power of two */
+        if (dy == 0) {
+            f0 = hf - dx;
+            f1 = dx;
+            af = 1 << (hbits - 1);
+            for (y = 0; y < h; y++) {
+                for (x = 0; x < w; x++) {
+                    dec[x] = (f0 * ref[x] + f1 * ref[x + 1] + af) >> hbits;
+                }
+                dec += ds;
+                ref += rs;
+            }
+            return;
+        }
+        if (dx == 0) {
+            f0 = vf - dy;
+            f2 = dy;
+            af = 1 << (vbits - 1);
+            for (y = 0; y < h; y++) {
+                for (x = 0; x < w; x++) {
+                    dec[x] = (f0 * ref[x] + f2 * ref[rs + x] + af) >> vbits;
+                }
+                dec += ds;
+                ref += rs;
+            }
+            return;
+        }
+
         f0 = (hf - dx) * (vf - dy);
         f1 = dx * (vf - dy);
         f2 = (hf - dx) * dy;
@@ -2641,7 +2871,7 @@ reconstruct(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_PLANE *refp, DSV_PLANE *resp
 {
     int i, j, r, x, y, bw, bh, sh, sv, limx, limy;
     DSV_MV *mv;
-    static uint8_t temp[DSV_MAX_BLOCK_SIZE * DSV_MAX_BLOCK_SIZE];
+    uint8_t temp[DSV_MAX_BLOCK_SIZE * DSV_MAX_BLOCK_SIZE];
 
     if (c == 0) {
         sh = 0;
@@ -3128,10 +3358,16 @@ decode_plane(DSV_BS *bs, DSV_COEFS *dst, int q, DSV_FMETA *fm)
     plen = bs_get_bits(bs, 32);
 
     bs_align(bs);
-    if (plen > 0 && plen < (dst->width * dst->height * sizeof(DSV_SBC) * 2)) {
+    if (bs_error(bs) || bs_ptr(bs) > bs->end || plen > bs->end - bs_ptr(bs)) {
+        DSV_ERROR(("plane length exceeds packet: %u", plen));
+        bs->err = 1;
+        success = 0;
+    } else if (plen > 0 && plen < (dst->width * dst->height * sizeof(DSV_SBC) * 2)) {
         DSV_SBC LL;
         unsigned start = bs_ptr(bs);
+        unsigned end = bs->end;
 
+        bs->end = start + plen; /* nothing of this plane lies past its length */
         LL = bs_get_seg(bs);
         hzcc_dec(bs, start + plen, dst, q, fm);
         dst->data[0] = LL;
@@ -3143,6 +3379,7 @@ decode_plane(DSV_BS *bs, DSV_COEFS *dst, int q, DSV_FMETA *fm)
         }
         bs_align(bs);
 
+        bs->end = end;
         bs_set(bs, start);
         bs_skip(bs, plen);
     } else {
@@ -3186,10 +3423,8 @@ decode_packet_hdr(DSV_BS *bs)
 
 /* B.2.1 Metadata Packet */
 static void
-decode_meta(DSV_DECODER *d, DSV_BS *bs)
+decode_meta(DSV_META *fmt, DSV_BS *bs)
 {
-    DSV_META *fmt = &d->vidmeta;
-
     fmt->width = bs_get_ueg(bs);
     fmt->height = bs_get_ueg(bs);
     DSV_DEBUG(("dimensions = %d x %d", fmt->width, fmt->height));
@@ -3214,9 +3449,56 @@ decode_meta(DSV_DECODER *d, DSV_BS *bs)
     }
 }
 
+static int
+valid_meta(DSV_META *fmt)
+{
+    int w, h;
+
+    switch (fmt->subsamp) {
+        case DSV_SUBSAMP_444:
+        case DSV_SUBSAMP_422:
+        case DSV_SUBSAMP_UYVY:
+        case DSV_SUBSAMP_420:
+        case DSV_SUBSAMP_411:
+        case DSV_SUBSAMP_410:
+            break;
+        default:
+            return 0;
+    }
+    /* same restrictions as the encoder */
+    if (fmt->width <= 0 || fmt->height <= 0 ||
+        (fmt->width & 1) || (fmt->height & 1)) {
+        return 0;
+    }
+    if (fmt->width > (1 << 24) || fmt->height > (1 << 24)) {
+        return 0;
+    }
+    /* every buffer sized from the picture (bordered frames, transform
+     * scratch, the coefficient planes) must have an int size. the largest
+     * is the three 4:4:4 coefficient planes */
+    w = fmt->width + 2 * DSV_FRAME_BORDER;
+    h = fmt->height + 2 * DSV_FRAME_BORDER;
+    return w <= (INT_MAX / (3 * (int) sizeof(DSV_SBC))) / h;
+}
+
+/* bounded reader for the next 'len' bytes of 'inbs', 'inbs' is moved past them */
+static void
+section_reader(DSV_BS *sub, DSV_BS *inbs, unsigned len)
+{
+    unsigned ptr = bs_ptr(inbs);
+
+    if (ptr > inbs->end || len > inbs->end - ptr) {
+        inbs->err = 1;
+        ptr = MIN(ptr, inbs->end);
+        len = 0;
+    }
+    bs_init_read(sub, inbs->start + ptr, len);
+    bs_skip(inbs, len);
+}
+
 /* B.2.3.4 Motion Data */
 static void
-decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stats)
+decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, int *stats)
 {
     DSV_PARAMS *params = &img->params;
     DSV_BS bs[DSV_SUB_NSUB];
@@ -3225,6 +3507,8 @@ decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stat
 
     bs_align(inbs);
 
+    bs_init_rle(&rle, NULL);
+    bs_init_rle(&prrle, NULL);
     for (i = 0; i < DSV_SUB_NSUB; i++) {
         int len;
 
@@ -3232,14 +3516,12 @@ decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stat
         bs_align(inbs);
 
         if (i == DSV_SUB_MODE) {
-            bs_init_rle(&rle, buf->data + bs_ptr(inbs));
+            section_reader(&rle.bs, inbs, len);
         } else if (i == DSV_SUB_EPRM) {
-            bs_init_rle(&prrle, buf->data + bs_ptr(inbs));
+            section_reader(&prrle.bs, inbs, len);
         } else {
-            bs_init(bs + i, buf->data + bs_ptr(inbs));
+            section_reader(bs + i, inbs, len);
         }
-
-        bs_skip(inbs, len);
     }
 
     for (j = 0; j < params->nblocks_v; j++) {
@@ -3307,11 +3589,16 @@ decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stat
 
     bs_end_rle(&rle);
     bs_end_rle(&prrle);
+    if (bs_error(&rle.bs) || bs_error(&prrle.bs) ||
+        bs_error(bs + DSV_SUB_MV_X) || bs_error(bs + DSV_SUB_MV_Y) ||
+        bs_error(bs + DSV_SUB_SBIM)) {
+        inbs->err = 1;
+    }
 }
 
 /* B.2.3.1 Stability Blocks */
 static void
-decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int isP, int *stats)
+decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, int isP, int *stats)
 {
     DSV_PARAMS *params = &img->params;
     DSV_ZBRLE qualrle;
@@ -3321,8 +3608,8 @@ decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int isP, int
     bs_align(inbs);
     len = bs_get_ueg(inbs);
     bs_align(inbs);
-    bs_init_rle(&qualrle, buf->data + bs_ptr(inbs));
-    bs_skip(inbs, len);
+    bs_init_rle(&qualrle, NULL);
+    section_reader(&qualrle.bs, inbs, len);
     nblk = params->nblocks_h * params->nblocks_v;
     for (i = 0; i < nblk; i++) {
         int bit = bs_get_rle(&qualrle);
@@ -3332,11 +3619,14 @@ decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int isP, int
         img->blockdata[i] = bit << shift;
     }
     bs_end_rle(&qualrle);
+    if (bs_error(&qualrle.bs)) {
+        inbs->err = 1;
+    }
 }
 
 /* B.2.3.2 Ringing Blocks & B.2.3.3 Maintain Blocks */
 static void
-decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int *stats)
+decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, int *stats)
 {
     DSV_PARAMS *params = &img->params;
     DSV_ZBRLE rle_r; /* ringing bits */
@@ -3346,14 +3636,14 @@ decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int *stats)
     bs_align(inbs);
     len = bs_get_ueg(inbs);
     bs_align(inbs);
-    bs_init_rle(&rle_r, buf->data + bs_ptr(inbs));
-    bs_skip(inbs, len);
+    bs_init_rle(&rle_r, NULL);
+    section_reader(&rle_r.bs, inbs, len);
 
     bs_align(inbs);
     len = bs_get_ueg(inbs);
     bs_align(inbs);
-    bs_init_rle(&rle_m, buf->data + bs_ptr(inbs));
-    bs_skip(inbs, len);
+    bs_init_rle(&rle_m, NULL);
+    section_reader(&rle_m.bs, inbs, len);
 
     nblk = params->nblocks_h * params->nblocks_v;
     for (i = 0; i < nblk; i++) {
@@ -3372,6 +3662,9 @@ decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int *stats)
     }
     bs_end_rle(&rle_r);
     bs_end_rle(&rle_m);
+    if (bs_error(&rle_r.bs) || bs_error(&rle_m.bs)) {
+        inbs->err = 1;
+    }
 }
 
 static void
@@ -3402,6 +3695,15 @@ d28_dec_free(DSV_DECODER *d)
     if (d->ref) {
         img_unref(d->ref);
     }
+    free_temp(&d->sbt_scratch);
+}
+
+static void
+release_buffer(DSV_DECODER *d, DSV_BUF *buffer)
+{
+    if (!d->keep_buffers) {
+        d28_buf_free(buffer);
+    }
 }
 
 extern DSV_META *
@@ -3432,37 +3734,56 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
 
     *fn = -1;
 
-    bs_init(&bs, buffer->data);
+    bs_init_read(&bs, buffer->data, buffer->len);
     pkt_type = decode_packet_hdr(&bs);
 
-    if (pkt_type == -1) {
-        d28_buf_free(buffer);
+    if (pkt_type == -1 || bs_error(&bs)) {
+        release_buffer(d, buffer);
         return DSV_DEC_ERROR;
     }
 
     if (!DSV_PT_IS_PIC(pkt_type)) {
         int ret = DSV_DEC_ERROR;
+        DSV_META newmeta;
+
         switch (pkt_type) {
             case DSV_PT_META:
                 DSV_DEBUG(("decoding metadata"));
-                decode_meta(d, &bs);
+                decode_meta(&newmeta, &bs);
+                if (bs_error(&bs) || !valid_meta(&newmeta)) {
+                    DSV_ERROR(("bad metadata packet"));
+                    break;
+                }
+                d->vidmeta = newmeta;
                 d->got_metadata = 1;
+                /* luma is the largest plane in every format */
+                alloc_temp(&d->sbt_scratch, SCRATCH_SIZE(d->vidmeta.width, d->vidmeta.height));
                 ret = DSV_DEC_GOT_META;
                 break;
             case DSV_PT_EOS:
                 DSV_DEBUG(("decoding end of stream"));
                 ret = DSV_DEC_EOS;
                 break;
+            case DSV_PT_TRAILER:
+                DSV_DEBUG(("skipping trailer"));
+                *out = NULL;
+                ret = DSV_DEC_OK;
+                break;
         }
-        d28_buf_free(buffer);
+        release_buffer(d, buffer);
         return ret;
     }
 
     if (!d->got_metadata) {
         DSV_WARNING(("no metadata, skipping frame"));
-        d28_buf_free(buffer);
+        release_buffer(d, buffer);
         return DSV_DEC_OK;
     }
+    if (DSV_PT_HAS_REF(pkt_type) && d->ref == NULL) {
+        DSV_WARNING(("reference frame not found"));
+        release_buffer(d, buffer);
+        return DSV_DEC_ERROR;
+    }
 
     img = (DSV_IMAGE*) d28_alloc(sizeof(DSV_IMAGE));
     img->refcount = 1;
@@ -3488,7 +3809,8 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
 
     if (p->blk_w < DSV_MIN_BLOCK_SIZE || p->blk_h < DSV_MIN_BLOCK_SIZE ||
         p->blk_w > DSV_MAX_BLOCK_SIZE || p->blk_h > DSV_MAX_BLOCK_SIZE) {
-        d28_buf_free(buffer);
+        img_unref(img);
+        release_buffer(d, buffer);
         return DSV_DEC_ERROR;
     }
     p->nblocks_h = DSV_UDIV_ROUND_UP(meta->width, p->blk_w);
@@ -3517,12 +3839,21 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     bs_align(&bs);
     /* read frame metadata (stability / skip, motion data / adaptive quant) */
     img->blockdata = (uint8_t*) d28_alloc(p->nblocks_h * p->nblocks_v);
-    decode_stability_blocks(img, &bs, buffer, has_ref, stats);
+    decode_stability_blocks(img, &bs, has_ref, stats);
     if (has_ref) {
         mvs = (DSV_MV*) d28_alloc(sizeof(DSV_MV) * p->nblocks_h * p->nblocks_v);
-        decode_motion(img, mvs, &bs, buffer, stats);
+        decode_motion(img, mvs, &bs, stats);
     } else {
-        decode_intra_meta(img, &bs, buffer, stats);
+        decode_intra_meta(img, &bs, stats);
+    }
+    if (bs_error(&bs)) {
+        DSV_ERROR(("picture packet too short"));
+        if (mvs) {
+            d28_free(mvs);
+        }
+        img_unref(img);
+        release_buffer(d, buffer);
+        return DSV_DEC_ERROR;
     }
 
     /* B.2.3.5 Image Data */
@@ -3533,6 +3864,7 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     fm.blockdata = img->blockdata;
     fm.isP = has_ref;
     fm.fnum = fno;
+    fm.scratch = &d->sbt_scratch;
     /* B.2.3.5 Image Data - Plane Decoding */
     mk_coefs(coefs, subsamp, meta->width, meta->height);
 
@@ -3546,6 +3878,17 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
         } else {
             DSV_ERROR(("decoding error in plane %d", i));
         }
+        if (bs_error(&bs)) {
+            DSV_ERROR(("plane %d ran past the end of the packet", i));
+            d28_free(coefs[0].data);
+            d28_frame_ref_dec(residual);
+            if (mvs) {
+                d28_free(mvs);
+            }
+            img_unref(img);
+            release_buffer(d, buffer);
+            return DSV_DEC_ERROR;
+        }
     }
 
     *fn = fno;
@@ -3557,10 +3900,6 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     }
     if (has_ref) {
         DSV_IMAGE *ref = d->ref;
-        if (ref == NULL) {
-            DSV_WARNING(("reference frame not found"));
-            return DSV_DEC_ERROR;
-        }
 
         p->temporal_mc = DSV_TEMPORAL_MC(fno);
         add_pred(mvs, &fm, quant, residual, img->out_frame, ref->ref_frame, do_filter);
@@ -3590,7 +3929,7 @@ d28_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
         d28_free(mvs);
     }
     if (buffer) {
-        d28_buf_free(buffer);
+        release_buffer(d, buffer);
     }
 
     img_unref(img);
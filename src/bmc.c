@@ -658,17 +658,48 @@ chroma_filter(DSV_MV *vecs, int q, DSV_PARAMS *p, DSV_PLANE *dp)
     }
 }
 
+#define BF_SHIFT  (DSV_HP_SHF + 1)
+#define BF_MULADD (1 << DSV_HP_SHF)
+
+/* fold the selected half-pel filter and the linear blend for a given
+ * quarter-pel phase into one set of 4-tap weights so the interpolation
+ * loops below are a plain multiply-accumulate with no per-pixel branching.
+ *
+ * blend(f) for phase 0..3 is (2b, f + b, 2f, f + c) in units of BF_MULADD
+ * where f = sharp * (b + c) - soft * (a + d) */
+static void
+qp_taps(int *t, int dq, int phase)
+{
+    int sharp, soft, wf, wb, wc;
+
+    if (dq) {
+        sharp = DSV_HPF_A(0, 1, 0, 0);
+        soft = -DSV_HPF_A(1, 0, 0, 0);
+    } else {
+        sharp = DSV_HPF_B(0, 1, 0, 0);
+        soft = -DSV_HPF_B(1, 0, 0, 0);
+    }
+    wf = (phase & 1) ? 1 : (phase & 2);
+    wb = (phase == 0) ? 2 : (phase == 1);
+    wc = (phase == 3);
+
+    t[0] = -wf * soft;
+    t[1] = wf * sharp + BF_MULADD * wb;
+    t[2] = wf * sharp + BF_MULADD * wc;
+    t[3] = -wf * soft;
+}
+
 static void
 luma_qp(uint8_t *dec, int ds,
         uint8_t *ref, int rs,
         int bw, int bh,
         int dx, int dy, int tmc)
 {
-    static int16_t tbuf[(DSV_MAX_BLOCK_SIZE + 3) * DSV_MAX_BLOCK_SIZE];
+    int16_t tbuf[(DSV_MAX_BLOCK_SIZE + 3) * DSV_MAX_BLOCK_SIZE];
     int16_t *tmp;
-    int x, y, a, b, c, d, f, large_mv, dqtx, dqty;
-#define BF_SHIFT  (DSV_HP_SHF + 1)
-#define BF_MULADD (1 << DSV_HP_SHF)
+    int x, y, t0, t1, t2, t3, large_mv, dqtx, dqty;
+    int tx[4], ty[4];
+
     tmp = tbuf;
 
     large_mv = abs(dx) >= 8 || abs(dy) >= 8;
@@ -686,82 +717,41 @@ luma_qp(uint8_t *dec, int ds,
      * every frame which generally averages out to a better approximation over
      * longer subpel motion sequences.
      */
+    qp_taps(tx, dqtx, dx);
+    qp_taps(ty, dqty, dy);
+
+    t0 = tx[0];
+    t1 = tx[1];
+    t2 = tx[2];
+    t3 = tx[3];
     for (y = 0; y < bh + 3; y++) {
         for (x = 0; x < bw; x++) {
-            a = ref[x + 0];
-            b = ref[x + 1];
-            c = ref[x + 2];
-            d = ref[x + 3];
-            if (dqtx) {
-                f = DSV_HPF_A(a, b, c, d);
-            } else {
-                f = DSV_HPF_B(a, b, c, d);
-            }
-#if 1
-            /* linear blend */
-            switch (dx) {
-                case 0:
-                    tmp[x] = (BF_MULADD * 2 * b + BF_MULADD) >> BF_SHIFT;
-                    break;
-                case 1:
-                    tmp[x] = (f + BF_MULADD * b + BF_MULADD) >> BF_SHIFT;
-                    break;
-                case 2:
-                    tmp[x] = (f * 2 + BF_MULADD) >> BF_SHIFT;
-                    break;
-                case 3:
-                    tmp[x] = (f + BF_MULADD * c + BF_MULADD) >> BF_SHIFT;
-                    break;
-            }
-#else
-            /* equivalent to above, it's slower but code is more concise */
-            if (dx & 2) {
-                tmp[x] = (f * (4 - dx) + BF_MULADD * c * (dx - 2) + BF_MULADD) >> BF_SHIFT;
-            } else {
-                tmp[x] = (f * dx + BF_MULADD * b * (2 - dx) + BF_MULADD) >> BF_SHIFT;
-            }
-#endif
+            tmp[x] = (t0 * ref[x + 0] +
+                      t1 * ref[x + 1] +
+                      t2 * ref[x + 2] +
+                      t3 * ref[x + 3] + BF_MULADD) >> BF_SHIFT;
         }
         tmp += DSV_MAX_BLOCK_SIZE;
         ref += rs;
     }
     tmp -= (bh + 3) * DSV_MAX_BLOCK_SIZE;
 
+    t0 = ty[0];
+    t1 = ty[1];
+    t2 = ty[2];
+    t3 = ty[3];
     for (y = 0; y < bh; y++) {
+        int16_t *r0, *r1, *r2, *r3;
+
+        r0 = tmp + 0 * DSV_MAX_BLOCK_SIZE;
+        r1 = tmp + 1 * DSV_MAX_BLOCK_SIZE;
+        r2 = tmp + 2 * DSV_MAX_BLOCK_SIZE;
+        r3 = tmp + 3 * DSV_MAX_BLOCK_SIZE;
         for (x = 0; x < bw; x++) {
-            a = tmp[x + 0 * DSV_MAX_BLOCK_SIZE];
-            b = tmp[x + 1 * DSV_MAX_BLOCK_SIZE];
-            c = tmp[x + 2 * DSV_MAX_BLOCK_SIZE];
-            d = tmp[x + 3 * DSV_MAX_BLOCK_SIZE];
-            if (dqty) {
-                f = DSV_HPF_A(a, b, c, d);
-            } else {
-                f = DSV_HPF_B(a, b, c, d);
-            }
-#if 1
-            /* linear blend */
-            switch (dy) {
-                case 0:
-                    dec[x] = clamp_u8((BF_MULADD * 2 * b + BF_MULADD) >> BF_SHIFT);
-                    break;
-                case 1:
-                    dec[x] = clamp_u8((f + BF_MULADD * b + BF_MULADD) >> BF_SHIFT);
-                    break;
-                case 2:
-                    dec[x] = clamp_u8((f * 2 + BF_MULADD) >> BF_SHIFT);
-                    break;
-                case 3:
-                    dec[x] = clamp_u8((f + BF_MULADD * c + BF_MULADD) >> BF_SHIFT);
-                    break;
-            }
-#else
-            /* equivalent to above, it's slower but code is more concise */
-            if (dy & 2) {
-                dec[x] = clamp_u8((f * (4 - dy) + BF_MULADD * c * (dy - 2) + BF_MULADD) >> BF_SHIFT);
-            } else {
-                dec[x] = clamp_u8((f * dy + BF_MULADD * b * (2 - dy) + BF_MULADD) >> BF_SHIFT);
-            }
-#endif
+            dec[x] = clamp_u8((t0 * r0[x] +
+                               t1 * r1[x] +
+                               t2 * r2[x] +
+                               t3 * r3[x] + BF_MULADD) >> BF_SHIFT);
         }
         dec += ds;
         tmp += DSV_MAX_BLOCK_SIZE;
@@ -789,6 +779,35 @@ bilinear_sp(
     if (dx | dy) {
         int x, y, f0, f1, f2, f3, af, sf;
 
+        /* one-dimensional offsets reduce exactly to a two-tap filter
+         * since the unused direction's weight is a power of two */
+        if (dy == 0) {
+            f0 = hf - dx;
+            f1 = dx;
+            af = 1 << (hbits - 1);
+            for (y = 0; y < h; y++) {
+                for (x = 0; x < w; x++) {
+                    dec[x] = (f0 * ref[x] + f1 * ref[x + 1] + af) >> hbits;
+                }
+                dec += ds;
+                ref += rs;
+            }
+            return;
+        }
+        if (dx == 0) {
+            f0 = vf - dy;
+            f2 = dy;
+            af = 1 << (vbits - 1);
+            for (y = 0; y < h; y++) {
+                for (x = 0; x < w; x++) {
+                    dec[x] = (f0 * ref[x] + f2 * ref[rs + x] + af) >> vbits;
+                }
+                dec += ds;
+                ref += rs;
+            }
+            return;
+        }
+
         f0 = (hf - dx) * (vf - dy);
         f1 = dx * (vf - dy);
         f2 = (hf - dx) * dy;
@@ -811,33 +830,46 @@ bilinear_sp(
     }
 }
 
+/* subsampling of plane 'c' in a picture decoded 'lowres' levels below
+ * full size. the vectors and block grid are scaled down the same way */
+static void
+plane_shifts(DSV_PARAMS *p, int c, int lowres, int *sh, int *sv)
+{
+    *sh = lowres;
+    *sv = lowres;
+    if (c != 0) {
+        *sh += DSV_FORMAT_H_SHIFT(p->vidmeta->subsamp);
+        *sv += DSV_FORMAT_V_SHIFT(p->vidmeta->subsamp);
+    }
+}
+
+/* start of block 'i' along a dimension. at reduced size blocks can be
+ * a single sample (or none) wide, so the edges are rounded per block */
+#define BLK_POS(i, bsz, s) (((i) * (bsz)) >> (s))
+
 static void
-predict(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
+predict(DSV_MV *vecs, DSV_PARAMS *p, int c, int lowres, DSV_FRAME *ref, DSV_PLANE *dp)
 {
     int i, j, r, x, y, bw, bh, sh, sv, limx, limy;
     DSV_PLANE *rp;
     DSV_MV *mv;
 
-    if (c == 0) {
-        sh = 0;
-        sv = 0;
-    } else {
-        sh = DSV_FORMAT_H_SHIFT(p->vidmeta->subsamp);
-        sv = DSV_FORMAT_V_SHIFT(p->vidmeta->subsamp);
-    }
-    bw = p->blk_w >> sh;
-    bh = p->blk_h >> sv;
-
-    limx = (dp->w - bw) + DSV_FRAME_BORDER - 1;
-    limy = (dp->h - bh) + DSV_FRAME_BORDER - 1;
+    plane_shifts(p, c, lowres, &sh, &sv);
     rp = ref->planes + c;
 
     for (j = 0; j < p->nblocks_v; j++) {
-        y = j * bh;
+        y = BLK_POS(j, p->blk_h, sv);
+        bh = BLK_POS(j + 1, p->blk_h, sv) - y;
+        limy = (dp->h - bh) + DSV_FRAME_BORDER - 1;
         for (i = 0; i < p->nblocks_h; i++) {
             int px, py;
-            x = i * bw;
+            x = BLK_POS(i, p->blk_w, sh);
+            bw = BLK_POS(i + 1, p->blk_w, sh) - x;
+            limx = (dp->w - bw) + DSV_FRAME_BORDER - 1;
             mv = &vecs[i + j * p->nblocks_h];
+            if (bw == 0 || bh == 0) {
+                continue;
+            }
 
             px = x + DSV_SAR(mv->u.mv.x, 2 + sh);
             py = y + DSV_SAR(mv->u.mv.y, 2 + sv);
@@ -862,7 +894,7 @@ predict(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
                         dec += dp->stride;
                     }
                 } else {
-                    int f, g, sbx, sby, sbw, sbh, mask_index;
+                    int f, g, sbx, sby, sbw, sbh, qw, qh, mask_index;
                     uint8_t masks[4] = {
                             DSV_MASK_INTRA00,
                             DSV_MASK_INTRA01,
@@ -871,36 +903,41 @@ predict(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
                     };
                     sbw = bw / 2;
                     sbh = bh / 2;
-                    mask_index = 0;
-
-                    for (g = 0; g <= sbh; g += (sbh + !sbh)) {
-                        for (f = 0; f <= sbw; f += (sbw + !sbw)) {
-                            sbx = x + f;
-                            sby = y + g;
-                            if (mv->submask & masks[mask_index]) {
-                                if (c == 0 && mv->dc) { /* DC is only for luma */
-                                    avgc = mv->dc;
-                                } else {
-                                    avgc = avgval(DSV_GET_XY(rp, px + f, py + g), rp->stride, sbw, sbh);
-                                }
-
-                                dec = DSV_GET_XY(dp, sbx, sby);
-                                for (r = 0; r < sbh; r++) {
-                                    memset(dec, avgc, sbw);
-                                    dec += dp->stride;
-                                }
+
+                    /* the right / bottom quadrants take the odd sample of
+                     * blocks that were scaled down to an odd size */
+                    for (mask_index = 0; mask_index < 4; mask_index++) {
+                        f = (mask_index & 1) ? sbw : 0;
+                        g = (mask_index & 2) ? sbh : 0;
+                        qw = (mask_index & 1) ? bw - sbw : sbw;
+                        qh = (mask_index & 2) ? bh - sbh : sbh;
+                        if (qw == 0 || qh == 0) {
+                            continue;
+                        }
+                        sbx = x + f;
+                        sby = y + g;
+                        if (mv->submask & masks[mask_index]) {
+                            if (c == 0 && mv->dc) { /* DC is only for luma */
+                                avgc = mv->dc;
                             } else {
-                                cpyblk(DSV_GET_XY(dp, sbx, sby),
-                                       DSV_GET_XY(rp, px + f, py + g),
-                                       dp->stride, rp->stride, sbw, sbh);
+                                avgc = avgval(DSV_GET_XY(rp, px + f, py + g), rp->stride, qw, qh);
+                            }
+
+                            dec = DSV_GET_XY(dp, sbx, sby);
+                            for (r = 0; r < qh; r++) {
+                                memset(dec, avgc, qw);
+                                dec += dp->stride;
                             }
-                            mask_index++;
+                        } else {
+                            cpyblk(DSV_GET_XY(dp, sbx, sby),
+                                   DSV_GET_XY(rp, px + f, py + g),
+                                   dp->stride, rp->stride, qw, qh);
                         }
                     }
                 }
             } else { /* inter */
                 /* D.1 Compensating Inter Blocks */
-                if (c == 0) {
+                if (c == 0 && !lowres) {
                     if (!DSV_IS_SUBPEL(mv)) {
                         px = CLAMP(px, -DSV_FRAME_BORDER, limx);
                         py = CLAMP(py, -DSV_FRAME_BORDER, limy);
@@ -913,6 +950,7 @@ predict(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
                                 bw, bh, mv->u.mv.x, mv->u.mv.y, p->temporal_mc);
                     }
                 } else {
+                    /* scaled down luma is interpolated like chroma */
                     px = CLAMP(px, -DSV_FRAME_BORDER, limx);
                     py = CLAMP(py, -DSV_FRAME_BORDER, limy);
                     bilinear_sp(DSV_GET_XY(dp, x, y), dp->stride, DSV_GET_XY(rp, px, py), rp->stride, bw, bh, mv->u.mv.x, mv->u.mv.y, sh, sv);
@@ -923,28 +961,22 @@ predict(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
 }
 
 static void
-reconstruct(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_PLANE *resp, DSV_PLANE *predp, DSV_PLANE *outp)
+reconstruct(DSV_MV *vecs, DSV_PARAMS *p, int c, int lowres, DSV_PLANE *resp, DSV_PLANE *predp, DSV_PLANE *outp)
 {
     int i, j, x, y, bw, bh, sh, sv;
     DSV_MV *mv;
 
-    if (c == 0) {
-        sh = 0;
-        sv = 0;
-    } else {
-        sh = DSV_FORMAT_H_SHIFT(p->vidmeta->subsamp);
-        sv = DSV_FORMAT_V_SHIFT(p->vidmeta->subsamp);
-    }
-    bw = p->blk_w >> sh;
-    bh = p->blk_h >> sv;
+    plane_shifts(p, c, lowres, &sh, &sv);
 
     for (j = 0; j < p->nblocks_v; j++) {
-        y = j * bh;
+        y = BLK_POS(j, p->blk_h, sv);
+        bh = BLK_POS(j + 1, p->blk_h, sv) - y;
         for (i = 0; i < p->nblocks_h; i++) {
             int m, n;
             uint8_t *res, *pred, *out;
 
-            x = i * bw;
+            x = BLK_POS(i, p->blk_w, sh);
+            bw = BLK_POS(i + 1, p->blk_w, sh) - x;
             mv = &vecs[i + j * p->nblocks_h];
 
             res = DSV_GET_XY(resp, x, y);
@@ -1064,7 +1096,7 @@ dsv_sub_pred(DSV_MV *mv, DSV_PARAMS *p, DSV_FRAME *pred, DSV_FRAME *resd, DSV_FR
         pp = pred->planes + c;
         rp = resd->planes + c;
 
-        predict(mv, p, c, ref, pp);
+        predict(mv, p, c, 0, ref, pp);
         subtract(mv, p, c, rp, pp);
     }
 }
@@ -1079,7 +1111,7 @@ dsv_add_res(DSV_MV *mv, DSV_FMETA *fm, int q, DSV_FRAME *resd, DSV_FRAME *pred,
         pp = pred->planes + c;
         rp = resd->planes + c;
 
-        reconstruct(mv, fm->params, c, rp, pp, rp);
+        reconstruct(mv, fm->params, c, 0, rp, pp, rp);
         if (c == 0) {
             luma_filter(mv, q, fm->params, rp, do_filter);
         } else {
@@ -1100,8 +1132,11 @@ dsv_add_pred(DSV_MV *mv, DSV_FMETA *fm, int q, DSV_FRAME *resd, DSV_FRAME *out,
         rp = resd->planes + c;
         op = out->planes + c;
 
-        predict(mv, fm->params, c, ref, op); /* make prediction onto temp frame (out) */
-        reconstruct(mv, fm->params, c, rp, op, op);
+        predict(mv, fm->params, c, fm->lowres, ref, op); /* make prediction onto temp frame (out) */
+        reconstruct(mv, fm->params, c, fm->lowres, rp, op, op);
+        if (fm->lowres) {
+            continue; /* the filters work on the block grid of the full picture */
+        }
         if (c == 0) {
             luma_filter(mv, q, fm->params, op, do_filter);
         } else {
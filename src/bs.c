@@ -23,8 +23,24 @@ dsv_bs_init(DSV_BS *bs, uint8_t *buffer)
 {
     bs->start = buffer;
     bs->pos = 0;
+    bs->end = UINT_MAX;
+    bs->err = 0;
 }
 
+extern void
+dsv_bs_init_read(DSV_BS *bs, uint8_t *buffer, unsigned len)
+{
+    dsv_bs_init(bs, buffer);
+    bs->end = len;
+}
+
+/* reads never touch memory past 'end'. instead the reader pretends the
+ * data continues as one bits (so unary prefixes terminate) and sets a
+ * sticky error flag that the caller checks once per section.
+ * the check is made once per field or once per byte, never per bit. */
+#define BS_OVERRUN(bs, ptr, nbytes) \
+    ((ptr) >= (bs)->end || (nbytes) > (bs)->end - (ptr))
+
 extern void
 dsv_bs_align(DSV_BS *bs)
 {
@@ -69,27 +85,88 @@ local_get_bit(DSV_BS *bs)
 {
     unsigned out;
 
+    if (dsv_bs_ptr(bs) >= bs->end) {
+        bs->err = 1;
+        bs->pos++;
+        return 1;
+    }
     out = bs->start[dsv_bs_ptr(bs)] >> (7 - (bs->pos & 7));
     bs->pos++;
 
     return out & 1;
 }
 
+/* the multi-bit reads and writes below work on a whole 32-bit word at once.
+ * a field of up to 24 bits plus the (at most 7 bit) offset into the first
+ * byte always fits, longer fields are split in two. only the bytes the
+ * field actually covers are ever touched. */
+#define WORD_BITS 24
+
 static void
 local_put_bits(DSV_BS *bs, unsigned n, unsigned v)
 {
-    unsigned rem, bit;
-    uint8_t data;
-
-    while (n > 0) {
-        rem = 8 - (bs->pos & 7);
-        rem = MIN(n, rem);
-        bit = (7 - (bs->pos & 7)) - rem + 1;
-        data = (v >> (n - rem)) & ((1 << rem) - 1);
-        bs->start[dsv_bs_ptr(bs)] |= data << bit;
-        n -= rem;
-        bs->pos += rem;
+    uint8_t *p;
+    unsigned end;
+    uint32_t w;
+
+    if (n > WORD_BITS) {
+        local_put_bits(bs, n - WORD_BITS, v >> WORD_BITS);
+        n = WORD_BITS;
+    }
+    if (n == 0) {
+        return;
+    }
+    p = bs->start + dsv_bs_ptr(bs);
+    end = (bs->pos & 7) + n;
+    w = (uint32_t) (v & ((1U << n) - 1)) << (32 - end);
+    p[0] |= w >> 24;
+    if (end > 8) {
+        p[1] |= w >> 16;
+        if (end > 16) {
+            p[2] |= w >> 8;
+            if (end > 24) {
+                p[3] |= w;
+            }
+        }
+    }
+    bs->pos += n;
+}
+
+static unsigned
+local_get_bits(DSV_BS *bs, unsigned n)
+{
+    uint8_t *p;
+    unsigned off, end, out;
+    uint32_t w;
+
+    if (n > WORD_BITS) {
+        out = local_get_bits(bs, n - WORD_BITS) << WORD_BITS;
+        return out | local_get_bits(bs, WORD_BITS);
+    }
+    if (n == 0) {
+        return 0;
+    }
+    off = bs->pos & 7;
+    end = off + n;
+    if (BS_OVERRUN(bs, dsv_bs_ptr(bs), (end + 7) >> 3)) {
+        bs->err = 1;
+        bs->pos += n;
+        return 0;
+    }
+    p = bs->start + dsv_bs_ptr(bs);
+    w = (uint32_t) p[0] << 24;
+    if (end > 8) {
+        w |= (uint32_t) p[1] << 16;
+        if (end > 16) {
+            w |= (uint32_t) p[2] << 8;
+            if (end > 24) {
+                w |= p[3];
+            }
+        }
     }
+    bs->pos += n;
+    out = (w << off) >> (32 - n);
+    return out;
 }
 
 extern void
@@ -113,18 +190,7 @@ dsv_bs_put_bits(DSV_BS *bs, unsigned n, unsigned v)
 extern unsigned
 dsv_bs_get_bits(DSV_BS *bs, unsigned n)
 {
-    unsigned rem, bit, out = 0;
-
-    while (n > 0) {
-        rem = 8 - (bs->pos & 7);
-        rem = MIN(n, rem);
-        bit = (7 - (bs->pos & 7)) - rem + 1;
-        out <<= rem;
-        out |= (bs->start[dsv_bs_ptr(bs)] & (((1 << rem) - 1) << bit)) >> bit;
-        n -= rem;
-        bs->pos += rem;
-    }
-    return out;
+    return local_get_bits(bs, n);
 }
 
 /* B. Encoding Type: unsigned interleaved exp-Golomb code (UEG) */
@@ -139,6 +205,15 @@ dsv_bs_put_ueg(DSV_BS *bs, unsigned v)
     for (n_bits = -1; x; n_bits++) {
         x >>= 1;
     }
+    if (n_bits <= 15) {
+        /* assemble the whole code and write it as one field */
+        x = 0;
+        for (i = n_bits - 1; i >= 0; i--) {
+            x = (x << 2) | ((v >> i) & 1);
+        }
+        local_put_bits(bs, 2 * n_bits + 1, (x << 1) | 1);
+        return;
+    }
     for (i = 0; i < n_bits; i++) {
         bs->pos++; /* equivalent to putting a zero, assuming buffer was clear */
         local_put_bit(bs, v & (1 << (n_bits - 1 - i)));
@@ -146,15 +221,113 @@ dsv_bs_put_ueg(DSV_BS *bs, unsigned v)
     local_put_one(bs);
 }
 
+/* the variable length readers walk a local copy of the current byte
+ * rather than re-indexing the buffer for every bit */
+#define CACHE_LOAD(bs, idx) \
+    ((idx) < (bs)->end ? (bs)->start[(idx)] : ((bs)->err = 1, 0xff))
+
+#define CACHE_BEGIN(bs, idx, cache, avail) \
+    do { \
+        (idx) = dsv_bs_ptr(bs); \
+        (avail) = 8 - ((bs)->pos & 7); \
+        (cache) = CACHE_LOAD(bs, idx) & ((1U << (avail)) - 1); \
+        (idx)++; \
+    } while (0)
+
+#define CACHE_END(bs, idx, avail) \
+    ((bs)->pos = (idx) * 8 - (avail))
+
+#define CACHE_BIT(bs, idx, cache, avail) \
+    ((avail) == 0 ? ((cache) = CACHE_LOAD(bs, idx), (idx)++, (avail) = 7, ((cache) >> 7) & 1) : \
+                    (((cache) >> --(avail)) & 1))
+
+/* table driven decoding of the short codes. a window of the next 25 to 32
+ * bits is read with one load when four bytes are left, whole bytes of it
+ * are decoded with one table lookup each. codes that do not end within
+ * the first three bytes take the bit serial path. */
+#define PEEK_BYTES 3
+
+static uint32_t
+peek_window(DSV_BS *bs)
+{
+    uint8_t *p = bs->start + dsv_bs_ptr(bs);
+    uint32_t w;
+
+    w = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+        ((uint32_t) p[2] << 8) | p[3];
+    return w << (bs->pos & 7);
+}
+
+/* UEG codes alternate a flag bit and a data bit, a byte always starts on a
+ * flag. (length << 4) | data bits if the code ends in the byte, otherwise
+ * the four data bits it carries */
+static const uint8_t ueg_tab[256] = {
+    0x00, 0x01, 0x70, 0x70, 0x02, 0x03, 0x71, 0x71, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50,
+    0x04, 0x05, 0x72, 0x72, 0x06, 0x07, 0x73, 0x73, 0x51, 0x51, 0x51, 0x51, 0x51, 0x51, 0x51, 0x51,
+    0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+    0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+    0x08, 0x09, 0x74, 0x74, 0x0a, 0x0b, 0x75, 0x75, 0x52, 0x52, 0x52, 0x52, 0x52, 0x52, 0x52, 0x52,
+    0x0c, 0x0d, 0x76, 0x76, 0x0e, 0x0f, 0x77, 0x77, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53,
+    0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+    0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+};
+
+/* number of leading zero bits */
+static const uint8_t lz_tab[256] = {
+    8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
 /* B. Encoding Type: unsigned interleaved exp-Golomb code (UEG) */
 extern unsigned
 dsv_bs_get_ueg(DSV_BS *bs)
 {
+    unsigned idx, cache, avail;
     unsigned v = 1;
 
-    while (!local_get_bit(bs)) {
-        v = (v << 1) | local_get_bit(bs);
+    if (!BS_OVERRUN(bs, dsv_bs_ptr(bs), 4)) {
+        uint32_t w = peek_window(bs);
+        unsigned i, e, len;
+
+        for (i = 0; i < PEEK_BYTES; i++) {
+            e = ueg_tab[w >> 24];
+            len = e >> 4;
+            if (len) {
+                bs->pos += i * 8 + len;
+                return ((v << (len >> 1)) | (e & 0xf)) - 1;
+            }
+            v = (v << 4) | e;
+            w <<= 8;
+        }
+        v = 1;
+    }
+    CACHE_BEGIN(bs, idx, cache, avail);
+    while (!CACHE_BIT(bs, idx, cache, avail)) {
+        v = (v << 1) | CACHE_BIT(bs, idx, cache, avail);
     }
+    CACHE_END(bs, idx, avail);
     return v - 1;
 }
 
@@ -246,6 +419,11 @@ dsv_bs_put_rice(DSV_BS *bs, unsigned v, int *rk, int damp)
         (*rk)--;
     }
     bs->pos += q; /* equivalent to putting 'q' zeroes, assuming buffer was clear */
+    if (k < 32) {
+        /* terminating one and the remainder as one field */
+        local_put_bits(bs, k + 1, (1U << k) | (v & ((1U << k) - 1)));
+        return;
+    }
     local_put_one(bs);
     local_put_bits(bs, k, v);
 }
@@ -255,16 +433,54 @@ extern unsigned
 dsv_bs_get_rice(DSV_BS *bs, int *rk, int damp)
 {
     int k = (*rk) >> damp;
+    unsigned idx, cache, avail;
     unsigned q = 0;
-    while (!local_get_bit(bs)) {
+
+    if (!BS_OVERRUN(bs, dsv_bs_ptr(bs), 4)) {
+        uint32_t w = peek_window(bs);
+        unsigned i, z, r;
+
+        for (i = 0; i < PEEK_BYTES; i++) {
+            z = lz_tab[(w << (i * 8)) >> 24];
+            q += z;
+            if (z < 8) {
+                break;
+            }
+        }
+        /* unary prefix, terminating one and remainder all in the window */
+        if (i < PEEK_BYTES && q + 1 + k <= 25) {
+            w <<= q + 1;
+            r = k ? (w >> (32 - k)) : 0;
+            bs->pos += q + 1 + k;
+            if (q) {
+                (*rk)++;
+            } else if ((*rk) > 0) {
+                (*rk)--;
+            }
+            return (q << k) | r;
+        }
+        q = 0;
+    }
+    CACHE_BEGIN(bs, idx, cache, avail);
+    /* unary prefix, whole zero bytes are skipped at once */
+    while (cache == 0) {
+        q += avail;
+        cache = CACHE_LOAD(bs, idx);
+        idx++;
+        avail = 8;
+    }
+    while (!((cache >> (avail - 1)) & 1)) {
+        avail--;
         q++;
     }
+    avail--; /* terminating one */
+    CACHE_END(bs, idx, avail);
     if (q) {
         (*rk)++;
     } else if ((*rk) > 0) {
         (*rk)--;
     }
-    return (q << k) | dsv_bs_get_bits(bs, k);
+    return (q << k) | local_get_bits(bs, k);
 }
 
 /* B. Encoding Type: non-zero adaptive Rice code (NRC) */
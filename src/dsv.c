@@ -38,70 +38,139 @@ dsv_get_log_level(void)
     return lvl;
 }
 
-#if DSV_MEMORY_STATS
-static unsigned allocated = 0;
-static unsigned freed = 0;
-static unsigned allocated_bytes = 0;
-static unsigned freed_bytes = 0;
-static unsigned peak_alloc = 0;
+/* stored right in front of every block dsv_alloc returns */
+typedef struct {
+    DSV_MEMORY *mem;
+    DSV_ALLOCATOR *allocator;
+    void *raw;
+    int size;
+} ALLOC_HDR;
 
-extern void *
-dsv_alloc(int size)
+#if DSV_MEMORY_STATS
+static void
+update_peak(DSV_MEMORY *m)
 {
-    void *p;
+    if (m->peak_alloc < (m->allocated_bytes - m->freed_bytes)) {
+        m->peak_alloc = (m->allocated_bytes - m->freed_bytes);
+    }
+}
 
-    p = calloc(1, size + 16);
-    if (!p) {
-        return NULL;
+extern void
+dsv_memory_pool_stat(DSV_MEMORY *m, int hit)
+{
+    if (m == NULL) {
+        return;
     }
-    *((int32_t *) p) = size;
-    allocated++;
-    allocated_bytes += size;
-    if (peak_alloc < (allocated_bytes - freed_bytes)) {
-        peak_alloc = (allocated_bytes - freed_bytes);
+    if (hit) {
+        m->pool_hits++;
+    } else {
+        m->pool_misses++;
     }
-    return (uint8_t *) p + 16;
 }
+#endif
 
-extern void
-dsv_free(void *ptr)
+static void *
+alloc_block(DSV_MEMORY *m, int size, int zero)
 {
-    uint8_t *p;
-    freed++;
-    p = ((uint8_t *) ptr) - 16;
-    freed_bytes += *((int32_t *) p);
-    if (peak_alloc < (allocated_bytes - freed_bytes)) {
-        peak_alloc = (allocated_bytes - freed_bytes);
-    }
-    free(p);
+    DSV_ALLOCATOR *a = m ? m->allocator : NULL;
+    ALLOC_HDR *hdr;
+    uint8_t *raw, *p;
+
+    /* the header gets a whole DSV_ALIGN sized slot in front of the data.
+     * without an aligned allocator, over-allocate and align by hand */
+    if (a == NULL) {
+        raw = malloc(size + DSV_ALIGN * 2);
+    } else if (a->aligned_alloc) {
+        raw = a->aligned_alloc(a->user, size + DSV_ALIGN, DSV_ALIGN);
+    } else {
+        raw = a->alloc(a->user, size + DSV_ALIGN * 2);
+    }
+    if (!raw) {
+        return NULL;
+    }
+    p = raw + DSV_ALIGN;
+    p += (DSV_ALIGN - ((size_t) p & (DSV_ALIGN - 1))) & (DSV_ALIGN - 1);
+    if (zero) {
+        memset(p, 0, size);
+    }
+    hdr = ((ALLOC_HDR *) p) - 1;
+    hdr->mem = m;
+    hdr->allocator = a;
+    hdr->raw = raw;
+    hdr->size = size;
+#if DSV_MEMORY_STATS
+    if (m) {
+        m->allocated++;
+        m->allocated_bytes += size;
+        update_peak(m);
+    }
+#endif
+    return p;
 }
 
-extern void
-dsv_memory_report(void)
+extern void *
+dsv_alloc(DSV_MEMORY *m, int size)
 {
-    DSV_DEBUG(("n alloc: %u", allocated));
-    DSV_DEBUG(("n freed: %u", freed));
-    DSV_DEBUG(("alloc bytes: %u", allocated_bytes));
-    DSV_DEBUG(("freed bytes: %u", freed_bytes));
-    DSV_DEBUG(("bytes not freed: %d", allocated_bytes - freed_bytes));
-    DSV_DEBUG(("peak alloc: %u", peak_alloc));
+    return alloc_block(m, size, 1);
 }
-#else
+
 extern void *
-dsv_alloc(int size)
+dsv_alloc_nozero(DSV_MEMORY *m, int size)
 {
-    return calloc(1, size);
+    return alloc_block(m, size, 0);
 }
 
 extern void
 dsv_free(void *ptr)
 {
-    free(ptr);
+    ALLOC_HDR *hdr;
+    DSV_ALLOCATOR *a;
+
+    if (ptr == NULL) {
+        return;
+    }
+    hdr = ((ALLOC_HDR *) ptr) - 1;
+    a = hdr->allocator;
+#if DSV_MEMORY_STATS
+    if (hdr->mem) {
+        hdr->mem->freed++;
+        hdr->mem->freed_bytes += hdr->size;
+        update_peak(hdr->mem);
+    }
+#endif
+    if (a == NULL) {
+        free(hdr->raw);
+    } else {
+        a->free(a->user, hdr->raw);
+    }
 }
 
 extern void
-dsv_memory_report(void)
+dsv_alloc_detach(void *ptr)
+{
+    if (ptr) {
+        (((ALLOC_HDR *) ptr) - 1)->mem = NULL;
+    }
+}
+
+#if DSV_MEMORY_STATS
+extern void
+dsv_memory_report(DSV_MEMORY *m)
 {
+    DSV_DEBUG(("n alloc: %u", m->allocated));
+    DSV_DEBUG(("n freed: %u", m->freed));
+    DSV_DEBUG(("alloc bytes: %u", m->allocated_bytes));
+    DSV_DEBUG(("freed bytes: %u", m->freed_bytes));
+    DSV_DEBUG(("bytes not freed: %d", m->allocated_bytes - m->freed_bytes));
+    DSV_DEBUG(("peak alloc: %u", m->peak_alloc));
+    DSV_DEBUG(("pool hits: %u", m->pool_hits));
+    DSV_DEBUG(("pool misses: %u", m->pool_misses));
+}
+#else
+extern void
+dsv_memory_report(DSV_MEMORY *m)
+{
+    (void) m;
     DSV_DEBUG(("memory stats are disabled"));
 }
 #endif
@@ -186,7 +255,7 @@ dsv_yuv_read(FILE *in, int fno, uint8_t *o, int width, int height, int subsamp)
         if (fseek(in, offset, SEEK_SET)) {
             return -1;
         }
-        tline = dsv_alloc(linebytes);
+        tline = dsv_alloc_nozero(NULL, linebytes);
         for (j = 0; j < height; j++) {
             uint8_t *tlp = tline;
             if (fread(tline, 1, linebytes, in) != linebytes) {
@@ -314,10 +383,10 @@ dsv_buf_free(DSV_BUF *buf)
 }
 
 extern void
-dsv_mk_buf(DSV_BUF *buf, int size)
+dsv_mk_buf(DSV_MEMORY *mem, DSV_BUF *buf, int size)
 {
     memset(buf, 0, sizeof(*buf));
-    buf->data = dsv_alloc(size);
+    buf->data = dsv_alloc(mem, size);
     buf->len = size;
 }
 
@@ -357,10 +426,19 @@ seg_bits(int v)
 extern int
 dsv_mv_cost(DSV_MV *vecs, DSV_PARAMS *p, int i, int j, int mx, int my, int q, int sqr)
 {
-    int px, py, bits;
-    int b2sr;
+    int px, py;
 
     dsv_movec_pred(vecs, p, i, j, &px, &py);
+    return dsv_mv_cost_pred(p, px, py, mx, my, q, sqr);
+}
+
+/* same as dsv_mv_cost but with an already computed predictor (px, py) */
+extern int
+dsv_mv_cost_pred(DSV_PARAMS *p, int px, int py, int mx, int my, int q, int sqr)
+{
+    int bits;
+    int b2sr;
+
     bits = seg_bits(mx - px) + seg_bits(my - py);
     b2sr = (256 * (q * q >> DSV_MAX_QP_BITS) * p->blk_w * p->blk_h) / (p->vidmeta->width * p->vidmeta->height);
     bits += bits * b2sr >> 7;
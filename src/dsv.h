@@ -38,6 +38,8 @@ extern "C" {
 #define DSV_PT_META 0x00
 #define DSV_PT_PIC  0x04
 #define DSV_PT_EOS  0x10
+/* not part of the v8 spec, decoders skip it. see dsv_index_trailer */
+#define DSV_PT_TRAILER 0x08
 #define DSV_MAKE_PT(is_ref, has_ref) (DSV_PT_PIC | ((is_ref) << 1) | (has_ref))
 
 #define DSV_PT_IS_PIC(x)   ((x) & DSV_PT_PIC)
@@ -98,6 +100,7 @@ extern "C" {
 #define DSV_FORMAT_V_SHIFT(format) ((format) & 0x3)
 
 typedef uint32_t DSV_FNUM; /* frame number */
+typedef int64_t DSV_OFFSET; /* byte position in a stream, -1 for none */
 
 typedef struct {
     int width;
@@ -118,6 +121,49 @@ typedef struct {
     int reserved;
 } DSV_META;
 
+/* memory returned by dsv_alloc is aligned to this many bytes,
+ * frame plane origins and strides are multiples of it too */
+#define DSV_ALIGN_SHIFT 6
+#define DSV_ALIGN (1 << DSV_ALIGN_SHIFT)
+
+/* user supplied allocator.
+ *
+ * alloc returns memory (or NULL on failure), it does not have to be
+ * zero-filled, the codec clears what it needs itself.
+ * aligned_alloc is optional, when set it is used instead of alloc and must
+ * return memory aligned to 'align' bytes.
+ * free is given the pointers returned by either of them.
+ * the allocator must stay valid until everything allocated through it
+ * has been freed.
+ */
+typedef struct {
+    void *(*alloc)(void *user, size_t size);
+    void *(*aligned_alloc)(void *user, size_t size, size_t align);
+    void (*free)(void *user, void *ptr);
+    void *user;
+} DSV_ALLOCATOR;
+
+/* allocation context, one per encoder / decoder.
+ * it is handed explicitly to everything that allocates on behalf of the
+ * instance, never kept in a global, so separate instances may run on
+ * separate threads. every allocation remembers the context it came from
+ * to keep its statistics. frames the decoder handed out are detached from
+ * the context when the decoder is freed and may outlive it, anything else
+ * allocated through it (e.g. encoded packets) must be freed first.
+ */
+typedef struct {
+    DSV_ALLOCATOR *allocator; /* set by user, NULL = calloc / free */
+
+    /* statistics, only kept when DSV_MEMORY_STATS is enabled */
+    unsigned allocated;
+    unsigned freed;
+    unsigned allocated_bytes;
+    unsigned freed_bytes;
+    unsigned peak_alloc;
+    unsigned pool_hits;
+    unsigned pool_misses;
+} DSV_MEMORY;
+
 typedef struct {
     uint8_t *data;
     int len;
@@ -126,7 +172,14 @@ typedef struct {
     int w, h;
 } DSV_PLANE;
 
-/* subband coefs */
+/* subband coefs
+ *
+ * these need the full 32 bits. the Haar LL band grows by 4x per level and
+ * only the top few levels are halved for overflow safety, so the DC of a
+ * flat white luma plane reaches ~5.2e7 at 1920x1080 and ~2.1e8 at
+ * 3840x2160. every level shares one plane, so a narrower type cannot be
+ * used even for the high frequency bands without changing the layout.
+ */
 typedef int32_t DSV_SBC;
 typedef struct {
     DSV_SBC *data;
@@ -134,7 +187,7 @@ typedef struct {
     int height;
 } DSV_COEFS;
 
-typedef struct {
+typedef struct DSV_FRAME {
     uint8_t *alloc;
 
     DSV_PLANE planes[3];
@@ -146,6 +199,15 @@ typedef struct {
     int height;
 
     int border;
+
+    struct DSV_POOL *pool; /* pool this frame returns to, NULL if none */
+    struct DSV_FRAME *pool_prev, *pool_next; /* frames the pool handed out */
+    DSV_MEMORY *mem; /* context the frame was allocated from */
+
+    /* set by user (optional), called once the last reference to the frame
+     * is gone, i.e. when the memory its planes point to may be reused */
+    void (*release)(void *user, struct DSV_FRAME *frame);
+    void *release_user;
 } DSV_FRAME;
 
 #define DSV_NDIF_THRESH   (2 * 4)
@@ -221,17 +283,31 @@ typedef struct {
 #define DSV_MAX_QP_BITS 12
 #define DSV_MAX_QP ((1 << DSV_MAX_QP_BITS) - 1)
 
-extern void dsv_mk_coefs(DSV_COEFS *frame, int format, int width, int height);
+/* 'mem' is the allocation context to use, NULL = calloc / free without
+ * statistics */
+extern void dsv_mk_coefs(DSV_MEMORY *mem, DSV_COEFS *frame, int format, int width, int height);
+
+/* pixels of padding around every plane of a frame made with a border */
+#define DSV_FRAME_BORDER DSV_MAX_BLOCK_SIZE
 
-extern DSV_FRAME *dsv_mk_frame(int format, int width, int height, int border);
-extern DSV_FRAME *dsv_load_planar_frame(int format, void *data, int width, int height);
+extern DSV_FRAME *dsv_mk_frame(DSV_MEMORY *mem, int format, int width, int height, int border);
+extern DSV_FRAME *dsv_load_planar_frame(DSV_MEMORY *mem, int format, void *data, int width, int height);
+/* wrap caller owned planes without copying them.
+ * if border is non-zero, every plane must have DSV_FRAME_BORDER pixels of
+ * writable memory around it, the encoder will then use the planes in place
+ * instead of copying them into a frame of its own */
+extern DSV_FRAME *dsv_wrap_frame(DSV_MEMORY *mem, int format, uint8_t *planes[3], int strides[3], int width, int height, int border);
 
+/* reference counting is not atomic. a frame that came from a pool (e.g.
+ * decoder output) goes back to it on its last dsv_frame_ref_dec, which
+ * must not run concurrently with the codec that owns the pool */
 extern DSV_FRAME *dsv_frame_ref_inc(DSV_FRAME *frame);
 extern void dsv_frame_ref_dec(DSV_FRAME *frame);
 
 extern void dsv_frame_copy(DSV_FRAME *dst, DSV_FRAME *src);
 extern void dsv_ds2x_frame_luma(DSV_FRAME *dest, DSV_FRAME *src);
 
+/* the clone comes from the same allocation context as 'f' */
 extern DSV_FRAME *dsv_clone_frame(DSV_FRAME *f, int border);
 extern DSV_FRAME *dsv_extend_frame(DSV_FRAME *frame);
 extern DSV_FRAME *dsv_extend_frame_luma(DSV_FRAME *frame);
@@ -265,6 +341,8 @@ typedef struct {
      * last 15 bits: reserved bits
      */
     int reserved;
+
+    DSV_MEMORY *mem; /* allocation context of the codec instance */
 } DSV_PARAMS;
 
 typedef struct {
@@ -272,7 +350,7 @@ typedef struct {
     unsigned len;
 } DSV_BUF;
 
-extern void dsv_mk_buf(DSV_BUF *buf, int size);
+extern void dsv_mk_buf(DSV_MEMORY *mem, DSV_BUF *buf, int size);
 extern void dsv_buf_free(DSV_BUF *buffer);
 
 extern int dsv_yuv_write(FILE *out, int fno, DSV_PLANE *p);
@@ -284,10 +362,15 @@ extern int dsv_yuv_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp);
 #define DSV_MEMORY_STATS 1
 #endif
 
-extern void *dsv_alloc(int size);
+/* NULL 'mem' allocates with malloc and keeps no statistics.
+ * dsv_alloc returns zero-filled memory, dsv_alloc_nozero leaves it as the
+ * allocator returned it, for buffers that are written before being read */
+extern void *dsv_alloc(DSV_MEMORY *mem, int size);
+extern void *dsv_alloc_nozero(DSV_MEMORY *mem, int size);
+/* NULL is ignored */
 extern void dsv_free(void *ptr);
 
-extern void dsv_memory_report(void);
+extern void dsv_memory_report(DSV_MEMORY *mem);
 
 #define DSV_LEVEL_NONE    0
 #define DSV_LEVEL_ERROR   1
@@ -49,10 +49,8 @@ decode_packet_hdr(DSV_BS *bs)
 
 /* B.2.1 Metadata Packet */
 static void
-decode_meta(DSV_DECODER *d, DSV_BS *bs)
+decode_meta(DSV_META *fmt, DSV_BS *bs)
 {
-    DSV_META *fmt = &d->vidmeta;
-
     fmt->width = dsv_bs_get_ueg(bs);
     fmt->height = dsv_bs_get_ueg(bs);
     DSV_DEBUG(("dimensions = %d x %d", fmt->width, fmt->height));
@@ -77,9 +75,56 @@ decode_meta(DSV_DECODER *d, DSV_BS *bs)
     }
 }
 
+/* bounded reader for the next 'len' bytes of 'inbs', 'inbs' is moved past them */
+static void
+section_reader(DSV_BS *sub, DSV_BS *inbs, unsigned len)
+{
+    unsigned ptr = dsv_bs_ptr(inbs);
+
+    if (ptr > inbs->end || len > inbs->end - ptr) {
+        inbs->err = 1;
+        ptr = MIN(ptr, inbs->end);
+        len = 0;
+    }
+    dsv_bs_init_read(sub, inbs->start + ptr, len);
+    dsv_bs_skip(inbs, len);
+}
+
+static int
+valid_meta(DSV_META *fmt)
+{
+    int w, h;
+
+    switch (fmt->subsamp) {
+        case DSV_SUBSAMP_444:
+        case DSV_SUBSAMP_422:
+        case DSV_SUBSAMP_UYVY:
+        case DSV_SUBSAMP_420:
+        case DSV_SUBSAMP_411:
+        case DSV_SUBSAMP_410:
+            break;
+        default:
+            return 0;
+    }
+    /* same restrictions as the encoder */
+    if (fmt->width <= 0 || fmt->height <= 0 ||
+        (fmt->width & 1) || (fmt->height & 1)) {
+        return 0;
+    }
+    if (fmt->width > (1 << 24) || fmt->height > (1 << 24)) {
+        return 0;
+    }
+    /* every buffer sized from the picture (bordered frames, transform
+     * scratch, the coefficient planes) must have an int size. the largest
+     * is the three 4:4:4 coefficient planes */
+    w = fmt->width + 2 * DSV_FRAME_BORDER + DSV_ALIGN;
+    h = fmt->height + 2 * DSV_FRAME_BORDER;
+    return w <= (INT_MAX / (3 * (int) sizeof(DSV_SBC))) / h;
+}
+
 /* B.2.3.4 Motion Data */
 static void
-decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stats)
+decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, int *stats)
 {
     DSV_PARAMS *params = &img->params;
     DSV_BS bs[DSV_SUB_NSUB];
@@ -88,6 +133,8 @@ decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stat
 
     dsv_bs_align(inbs);
 
+    dsv_bs_init_rle(&rle, NULL);
+    dsv_bs_init_rle(&prrle, NULL);
     for (i = 0; i < DSV_SUB_NSUB; i++) {
         int len;
 
@@ -95,14 +142,12 @@ decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stat
         dsv_bs_align(inbs);
 
         if (i == DSV_SUB_MODE) {
-            dsv_bs_init_rle(&rle, buf->data + dsv_bs_ptr(inbs));
+            section_reader(&rle.bs, inbs, len);
         } else if (i == DSV_SUB_EPRM) {
-            dsv_bs_init_rle(&prrle, buf->data + dsv_bs_ptr(inbs));
+            section_reader(&prrle.bs, inbs, len);
         } else {
-            dsv_bs_init(bs + i, buf->data + dsv_bs_ptr(inbs));
+            section_reader(bs + i, inbs, len);
         }
-
-        dsv_bs_skip(inbs, len);
     }
 
     for (j = 0; j < params->nblocks_v; j++) {
@@ -170,11 +215,16 @@ decode_motion(DSV_IMAGE *img, DSV_MV *mvs, DSV_BS *inbs, DSV_BUF *buf, int *stat
 
     dsv_bs_end_rle(&rle, 1);
     dsv_bs_end_rle(&prrle, 1);
+    if (dsv_bs_error(&rle.bs) || dsv_bs_error(&prrle.bs) ||
+        dsv_bs_error(bs + DSV_SUB_MV_X) || dsv_bs_error(bs + DSV_SUB_MV_Y) ||
+        dsv_bs_error(bs + DSV_SUB_SBIM)) {
+        inbs->err = 1;
+    }
 }
 
 /* B.2.3.1 Stability Blocks */
 static void
-decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int isP, int *stats)
+decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, int isP, int *stats)
 {
     DSV_PARAMS *params = &img->params;
     DSV_ZBRLE qualrle;
@@ -184,8 +234,8 @@ decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int isP, int
     dsv_bs_align(inbs);
     len = dsv_bs_get_ueg(inbs);
     dsv_bs_align(inbs);
-    dsv_bs_init_rle(&qualrle, buf->data + dsv_bs_ptr(inbs));
-    dsv_bs_skip(inbs, len);
+    dsv_bs_init_rle(&qualrle, NULL);
+    section_reader(&qualrle.bs, inbs, len);
     nblk = params->nblocks_h * params->nblocks_v;
     for (i = 0; i < nblk; i++) {
         int bit = dsv_bs_get_rle(&qualrle);
@@ -195,11 +245,14 @@ decode_stability_blocks(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int isP, int
         img->blockdata[i] = bit << shift;
     }
     dsv_bs_end_rle(&qualrle, 1);
+    if (dsv_bs_error(&qualrle.bs)) {
+        inbs->err = 1;
+    }
 }
 
 /* B.2.3.2 Ringing Blocks & B.2.3.3 Maintain Blocks */
 static void
-decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int *stats)
+decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, int *stats)
 {
     DSV_PARAMS *params = &img->params;
     DSV_ZBRLE rle_r; /* ringing bits */
@@ -209,14 +262,14 @@ decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int *stats)
     dsv_bs_align(inbs);
     len = dsv_bs_get_ueg(inbs);
     dsv_bs_align(inbs);
-    dsv_bs_init_rle(&rle_r, buf->data + dsv_bs_ptr(inbs));
-    dsv_bs_skip(inbs, len);
+    dsv_bs_init_rle(&rle_r, NULL);
+    section_reader(&rle_r.bs, inbs, len);
 
     dsv_bs_align(inbs);
     len = dsv_bs_get_ueg(inbs);
     dsv_bs_align(inbs);
-    dsv_bs_init_rle(&rle_m, buf->data + dsv_bs_ptr(inbs));
-    dsv_bs_skip(inbs, len);
+    dsv_bs_init_rle(&rle_m, NULL);
+    section_reader(&rle_m.bs, inbs, len);
 
     nblk = params->nblocks_h * params->nblocks_v;
     for (i = 0; i < nblk; i++) {
@@ -235,6 +288,9 @@ decode_intra_meta(DSV_IMAGE *img, DSV_BS *inbs, DSV_BUF *buf, int *stats)
     }
     dsv_bs_end_rle(&rle_r, 1);
     dsv_bs_end_rle(&rle_m, 1);
+    if (dsv_bs_error(&rle_r.bs) || dsv_bs_error(&rle_m.bs)) {
+        inbs->err = 1;
+    }
 }
 
 #define DEBUG_SHADE 255
@@ -377,6 +433,276 @@ dsv_dec_free(DSV_DECODER *d)
     if (d->ref) {
         img_unref(d->ref);
     }
+    dsv_sbt_free_scratch(d->sbt_scratch);
+    d->sbt_scratch = NULL;
+    if (d->mvs) {
+        dsv_free(d->mvs);
+        d->mvs = NULL;
+    }
+    d->nmvs = 0;
+    /* frames the caller still holds free themselves when released */
+    dsv_pool_release(d->pool);
+    d->pool = NULL;
+}
+
+extern void
+dsv_dec_flush(DSV_DECODER *d)
+{
+    if (d->ref) {
+        img_unref(d->ref);
+        d->ref = NULL;
+    }
+}
+
+extern void
+dsv_index_init(DSV_INDEX *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+    idx->last_meta = -1;
+}
+
+static unsigned
+get_u32(uint8_t *p)
+{
+    return ((unsigned) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* returns NULL if the index could not grow, it is left as it was */
+static DSV_INDEX_ENTRY *
+index_add(DSV_INDEX *idx)
+{
+    if (idx->n == idx->cap) {
+        DSV_INDEX_ENTRY *grown;
+        int cap = idx->cap ? idx->cap * 2 : 256;
+
+        grown = dsv_alloc_nozero(NULL, cap * sizeof(DSV_INDEX_ENTRY));
+        if (grown == NULL) {
+            DSV_ERROR(("out of memory"));
+            return NULL;
+        }
+        if (idx->entries) {
+            memcpy(grown, idx->entries, idx->n * sizeof(DSV_INDEX_ENTRY));
+            dsv_free(idx->entries);
+        }
+        idx->entries = grown;
+        idx->cap = cap;
+    }
+    return &idx->entries[idx->n++];
+}
+
+extern DSV_OFFSET
+dsv_index_packet(DSV_INDEX *idx, uint8_t *data, unsigned len, DSV_OFFSET offset)
+{
+    DSV_INDEX_ENTRY *e;
+    int pkt_type;
+
+    if (len < DSV_PACKET_HDR_SIZE ||
+        data[0] != DSV_FOURCC_0 || data[1] != DSV_FOURCC_1 ||
+        data[2] != DSV_FOURCC_2 || data[3] != DSV_FOURCC_3) {
+        return -1;
+    }
+    pkt_type = data[DSV_PACKET_TYPE_OFFSET];
+    if (pkt_type == DSV_PT_META) {
+        idx->last_meta = offset;
+    } else if (DSV_PT_IS_PIC(pkt_type)) {
+        if (len < DSV_INDEX_PEEK) {
+            return -1;
+        }
+        e = index_add(idx);
+        if (e == NULL) {
+            return -2;
+        }
+        e->offset = offset;
+        e->meta = idx->last_meta;
+        /* B.2.3 the frame number follows the (byte aligned) header */
+        e->fno = get_u32(data + DSV_PACKET_HDR_SIZE);
+        e->intra = !DSV_PT_HAS_REF(pkt_type);
+        e->size = get_u32(data + DSV_PACKET_NEXT_OFFSET);
+        e->quality = -1;
+    }
+    return get_u32(data + DSV_PACKET_NEXT_OFFSET);
+}
+
+/* see encode_trailer in the encoder for the layout */
+extern int
+dsv_index_trailer(DSV_INDEX *idx, uint8_t *data, unsigned len, DSV_OFFSET offset)
+{
+    DSV_BS bs;
+    DSV_INDEX_ENTRY *e;
+    unsigned i, n, metasize;
+    DSV_FNUM fno;
+    DSV_OFFSET pos = 0;
+
+    dsv_index_free(idx);
+    if (len < DSV_PACKET_HDR_SIZE ||
+        data[0] != DSV_FOURCC_0 || data[1] != DSV_FOURCC_1 ||
+        data[2] != DSV_FOURCC_2 || data[3] != DSV_FOURCC_3 ||
+        data[DSV_PACKET_TYPE_OFFSET] != DSV_PT_TRAILER) {
+        return 0;
+    }
+    dsv_bs_init_read(&bs, data, len);
+    dsv_bs_skip(&bs, DSV_PACKET_HDR_SIZE);
+    n = dsv_bs_get_ueg(&bs);
+    fno = dsv_bs_get_ueg(&bs);
+    /* every picture takes at least 4 bits */
+    if (dsv_bs_error(&bs) || n > (len - DSV_PACKET_HDR_SIZE) * 2) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        e = index_add(idx);
+        if (e == NULL) {
+            break;
+        }
+        e->intra = dsv_bs_get_bit(&bs);
+        metasize = dsv_bs_get_ueg(&bs);
+        e->size = dsv_bs_get_ueg(&bs);
+        e->quality = dsv_bs_get_ueg(&bs);
+        e->fno = fno++;
+        if (metasize) {
+            idx->last_meta = pos;
+            pos += metasize;
+        }
+        e->meta = idx->last_meta;
+        e->offset = pos;
+        pos += e->size;
+        if (dsv_bs_error(&bs) || e->size < DSV_PACKET_HDR_SIZE || pos > offset) {
+            break;
+        }
+    }
+    /* the pictures have to account for everything before the trailer */
+    if (i < n || pos != offset) {
+        dsv_index_free(idx);
+        return 0;
+    }
+    return 1;
+}
+
+extern int
+dsv_index_seek(DSV_INDEX *idx, int n)
+{
+    int i;
+
+    if (n >= idx->n) {
+        n = idx->n - 1;
+    }
+    for (i = n; i >= 0; i--) {
+        if (idx->entries[i].intra && idx->entries[i].meta >= 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#define INDEX_MAGIC "DSV2 index 1"
+
+/* C89 has no printf/scanf conversion for 64 bit integers,
+ * offsets are written and parsed as decimal strings by hand */
+static void
+put_offset(FILE *out, DSV_OFFSET v)
+{
+    char buf[24];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    if (v < 0) {
+        fputs("-1", out); /* the only negative offset is 'none' */
+        return;
+    }
+    do {
+        buf[--i] = '0' + (int) (v % 10);
+        v /= 10;
+    } while (v > 0);
+    fputs(buf + i, out);
+}
+
+static int
+get_offset(FILE *in, DSV_OFFSET *v)
+{
+    char buf[24];
+    char *p = buf;
+
+    if (fscanf(in, "%23s", buf) != 1) {
+        return 0;
+    }
+    if (strcmp(buf, "-1") == 0) {
+        *v = -1;
+        return 1;
+    }
+    *v = 0;
+    do {
+        if (*p < '0' || *p > '9' || *v > (INT64_MAX - (*p - '0')) / 10) {
+            return 0;
+        }
+        *v = *v * 10 + (*p - '0');
+    } while (*++p);
+    return 1;
+}
+
+extern int
+dsv_index_write(DSV_INDEX *idx, FILE *out, DSV_OFFSET streamsz)
+{
+    int i;
+
+    fputs(INDEX_MAGIC " ", out);
+    put_offset(out, streamsz);
+    fprintf(out, " %d\n", idx->n);
+    for (i = 0; i < idx->n; i++) {
+        DSV_INDEX_ENTRY *e = &idx->entries[i];
+
+        put_offset(out, e->offset);
+        fputc(' ', out);
+        put_offset(out, e->meta);
+        fprintf(out, " %lu %d\n", (unsigned long) e->fno, e->intra);
+    }
+    return !ferror(out);
+}
+
+extern int
+dsv_index_read(DSV_INDEX *idx, FILE *in, DSV_OFFSET streamsz)
+{
+    char magic[sizeof(INDEX_MAGIC)];
+    DSV_OFFSET sz;
+    int i, n;
+
+    dsv_index_free(idx);
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        memcmp(magic, INDEX_MAGIC " ", sizeof(magic)) != 0 ||
+        !get_offset(in, &sz) || fscanf(in, "%d", &n) != 1 ||
+        sz != streamsz || n < 0) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        DSV_INDEX_ENTRY *e = index_add(idx);
+        unsigned long fno;
+
+        if (e == NULL || !get_offset(in, &e->offset) || !get_offset(in, &e->meta) ||
+            fscanf(in, "%lu %d", &fno, &e->intra) != 2 ||
+            e->offset < 0 || e->offset >= streamsz || e->meta >= streamsz) {
+            dsv_index_free(idx);
+            return 0;
+        }
+        e->fno = fno;
+        e->size = 0;
+        e->quality = -1;
+    }
+    return 1;
+}
+
+extern void
+dsv_index_free(DSV_INDEX *idx)
+{
+    if (idx->entries) {
+        dsv_free(idx->entries);
+    }
+    dsv_index_init(idx);
+}
+
+static void
+release_buffer(DSV_DECODER *d, DSV_BUF *buffer)
+{
+    if (!d->keep_buffers) {
+        dsv_buf_free(buffer);
+    }
 }
 
 extern DSV_META *
@@ -384,7 +710,7 @@ dsv_get_metadata(DSV_DECODER *d)
 {
     DSV_META *meta;
 
-    meta = dsv_alloc(sizeof(DSV_META));
+    meta = dsv_alloc(&d->mem, sizeof(DSV_META));
     memcpy(meta, &d->vidmeta, sizeof(DSV_META));
 
     return meta;
@@ -397,6 +723,7 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     DSV_IMAGE *img;
     DSV_PARAMS *p;
     int i, quant, is_ref, pkt_type, subsamp, do_filter;
+    int lowres, width, height;
     DSV_META *meta = &d->vidmeta;
     DSV_FRAME *residual;
     DSV_MV *mvs = NULL;
@@ -404,51 +731,95 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     DSV_FMETA fm;
     int stats[DSV_MAX_STAT];
     DSV_COEFS coefs[3];
+    DSV_BS pbs[3];
 
     *fn = -1;
 
-    dsv_bs_init(&bs, buffer->data);
+    dsv_bs_init_read(&bs, buffer->data, buffer->len);
     pkt_type = decode_packet_hdr(&bs);
 
-    if (pkt_type == -1) {
-        dsv_buf_free(buffer);
+    if (pkt_type == -1 || dsv_bs_error(&bs)) {
+        release_buffer(d, buffer);
         return DSV_DEC_ERROR;
     }
 
     if (!DSV_PT_IS_PIC(pkt_type)) {
         int ret = DSV_DEC_ERROR;
+        DSV_META newmeta;
+
         switch (pkt_type) {
             case DSV_PT_META:
                 DSV_DEBUG(("decoding metadata"));
-                decode_meta(d, &bs);
+                decode_meta(&newmeta, &bs);
+                if (dsv_bs_error(&bs) || !valid_meta(&newmeta)) {
+                    DSV_ERROR(("bad metadata packet"));
+                    break;
+                }
+                d->vidmeta = newmeta;
                 d->got_metadata = 1;
+                /* luma is the largest plane in every format */
+                if (d->sbt_scratch == NULL) {
+                    d->sbt_scratch = dsv_sbt_new_scratch(&d->mem);
+                }
+                dsv_sbt_alloc_scratch(d->sbt_scratch, d->vidmeta.width, d->vidmeta.height);
+                if (d->pool == NULL) {
+                    d->pool = dsv_pool_new(&d->mem);
+                }
                 ret = DSV_DEC_GOT_META;
                 break;
             case DSV_PT_EOS:
                 DSV_DEBUG(("decoding end of stream"));
                 ret = DSV_DEC_EOS;
                 break;
+            case DSV_PT_TRAILER:
+                DSV_DEBUG(("skipping trailer"));
+                *out = NULL;
+                ret = DSV_DEC_OK;
+                break;
         }
-        dsv_buf_free(buffer);
+        release_buffer(d, buffer);
         return ret;
     }
 
     if (!d->got_metadata) {
         DSV_WARNING(("no metadata, skipping frame"));
-        dsv_buf_free(buffer);
+        release_buffer(d, buffer);
         return DSV_DEC_OK;
     }
+    if (DSV_PT_HAS_REF(pkt_type) && d->fast) {
+        /* the packet type alone says it needs a reference, skip it */
+        dsv_bs_align(&bs);
+        *fn = dsv_bs_get_bits(&bs, 32);
+        release_buffer(d, buffer);
+        return DSV_DEC_SKIPPED;
+    }
+    lowres = (d->fast == DSV_FAST_THUMB) ? DSV_MAX_LOWRES : CLAMP(d->lowres, 0, DSV_MAX_LOWRES);
+    width = DSV_ROUND_SHIFT(meta->width, lowres);
+    height = DSV_ROUND_SHIFT(meta->height, lowres);
+    if (DSV_PT_HAS_REF(pkt_type) && d->ref == NULL) {
+        DSV_WARNING(("reference frame not found"));
+        release_buffer(d, buffer);
+        return DSV_DEC_ERROR;
+    }
+    if (DSV_PT_HAS_REF(pkt_type) && (d->ref->ref_frame->width != width ||
+            d->ref->ref_frame->height != height)) {
+        DSV_WARNING(("reference frame has a different scale"));
+        release_buffer(d, buffer);
+        return DSV_DEC_ERROR;
+    }
 
-    img = dsv_alloc(sizeof(DSV_IMAGE));
+    img = dsv_alloc(&d->mem, sizeof(DSV_IMAGE));
     img->refcount = 1;
 
     img->params.vidmeta = meta;
+    img->params.mem = &d->mem;
 
     subsamp = meta->subsamp;
 
     p = &img->params;
     p->has_ref = DSV_PT_HAS_REF(pkt_type);
-    is_ref = DSV_PT_IS_REF(pkt_type);
+    /* nothing that needs a reference gets decoded in fast modes */
+    is_ref = DSV_PT_IS_REF(pkt_type) && !d->fast;
 
     /* B.2.3 Picture Packet */
 
@@ -463,7 +834,8 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
 
     if (p->blk_w < DSV_MIN_BLOCK_SIZE || p->blk_h < DSV_MIN_BLOCK_SIZE ||
         p->blk_w > DSV_MAX_BLOCK_SIZE || p->blk_h > DSV_MAX_BLOCK_SIZE) {
-        dsv_buf_free(buffer);
+        img_unref(img);
+        release_buffer(d, buffer);
         return DSV_DEC_ERROR;
     }
     p->nblocks_h = DSV_UDIV_ROUND_UP(meta->width, p->blk_w);
@@ -491,36 +863,96 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     }
     dsv_bs_align(&bs);
     /* read frame metadata (stability / skip, motion data / adaptive quant) */
-    img->blockdata = dsv_alloc(p->nblocks_h * p->nblocks_v);
-    decode_stability_blocks(img, &bs, buffer, p->has_ref, stats);
+    img->blockdata = dsv_alloc(&d->mem, p->nblocks_h * p->nblocks_v);
+    decode_stability_blocks(img, &bs, p->has_ref, stats);
     if (p->has_ref) {
-        mvs = dsv_alloc(sizeof(DSV_MV) * p->nblocks_h * p->nblocks_v);
-        decode_motion(img, mvs, &bs, buffer, stats);
+        int nmvs = p->nblocks_h * p->nblocks_v;
+
+        if (d->nmvs < nmvs) {
+            if (d->mvs) {
+                dsv_free(d->mvs);
+            }
+            d->mvs = dsv_alloc(&d->mem, sizeof(DSV_MV) * nmvs);
+            d->nmvs = nmvs;
+        } else {
+            /* decode_motion only sets the flags it reads */
+            memset(d->mvs, 0, sizeof(DSV_MV) * nmvs);
+        }
+        mvs = d->mvs;
+        decode_motion(img, mvs, &bs, stats);
     } else {
-        decode_intra_meta(img, &bs, buffer, stats);
+        decode_intra_meta(img, &bs, stats);
+    }
+    if (dsv_bs_error(&bs)) {
+        DSV_ERROR(("picture packet too short"));
+        img_unref(img);
+        release_buffer(d, buffer);
+        return DSV_DEC_ERROR;
     }
 
     /* B.2.3.5 Image Data */
     dsv_bs_align(&bs);
 
-    residual = dsv_mk_frame(subsamp, meta->width, meta->height, 1);
+    residual = dsv_pool_mk_frame(d->pool, subsamp, width, height, 1);
     fm.params = p;
     fm.blockdata = img->blockdata;
     fm.isP = p->has_ref;
+    fm.lowres = lowres;
     fm.fnum = fno;
+    fm.scratch = d->sbt_scratch;
     /* B.2.3.5 Image Data - Plane Decoding */
-    dsv_mk_coefs(coefs, subsamp, meta->width, meta->height);
+    dsv_pool_mk_coefs(d->pool, coefs, subsamp, meta->width, meta->height);
+    /* only coded coefficients are written, everything else must be zero.
+     * at reduced resolution only the corner that gets recomposed is read */
+    for (i = 0; i < 3; i++) {
+        DSV_COEFS *c = &coefs[i];
+
+        if (lowres) {
+            int y, sw, sh;
 
+            sw = DSV_ROUND_SHIFT(c->width, lowres);
+            sh = DSV_ROUND_SHIFT(c->height, lowres);
+            for (y = 0; y < sh; y++) {
+                memset(c->data + y * c->width, 0, sw * sizeof(DSV_SBC));
+            }
+        } else {
+            memset(c->data, 0, c->width * c->height * sizeof(DSV_SBC));
+        }
+    }
+
+    /* every plane is prefixed by its length, locate all of them first so
+     * each plane is decoded from its own reader and no plane depends on
+     * how the previous one was parsed */
+    for (i = 0; i < 3; i++) {
+        unsigned plen;
+
+        dsv_bs_align(&bs);
+        pbs[i] = bs;
+        plen = dsv_bs_get_bits(&bs, 32);
+        if (dsv_bs_ptr(&bs) <= buffer->len &&
+                plen <= (buffer->len - dsv_bs_ptr(&bs))) {
+            dsv_bs_skip(&bs, plen);
+        }
+    }
     for (i = 0; i < 3; i++) {
         fm.cur_plane = i;
-        if (dsv_decode_plane(&bs, &coefs[i], quant, &fm)) {
+        if (dsv_decode_plane(&pbs[i], &coefs[i], quant, &fm)) {
             dsv_inv_sbt(&residual->planes[i], &coefs[i], quant, &fm);
-            if (!fm.isP) {
+            /* the filter works on the block grid of the full picture */
+            if (!fm.isP && !lowres) {
                 dsv_intra_filter(quant, p, &fm, i, &residual->planes[i], do_filter);
             }
         } else {
             DSV_ERROR(("decoding error in plane %d", i));
         }
+        if (dsv_bs_error(&pbs[i])) {
+            DSV_ERROR(("plane %d ran past the end of the packet", i));
+            dsv_pool_free_coefs(d->pool, coefs);
+            dsv_frame_ref_dec(residual);
+            img_unref(img);
+            release_buffer(d, buffer);
+            return DSV_DEC_ERROR;
+        }
     }
 
     *fn = fno;
@@ -528,14 +960,10 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     img->refcount++;
 
     if (!img->out_frame) {
-        img->out_frame = dsv_mk_frame(subsamp, meta->width, meta->height, 1);
+        img->out_frame = dsv_pool_mk_frame(d->pool, subsamp, width, height, 1);
     }
     if (p->has_ref) {
         DSV_IMAGE *ref = d->ref;
-        if (ref == NULL) {
-            DSV_WARNING(("reference frame not found"));
-            return DSV_DEC_ERROR;
-        }
 
 #if 0 /* SHOW RESIDUAL */
         dsv_frame_copy(img->out_frame, residual);
@@ -553,18 +981,18 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     }
 
     /* draw debug information on the frame */
-    if (d->draw_info) {
-        DSV_FRAME *tmp = dsv_clone_frame(img->out_frame, 0);
+    if (d->draw_info && !lowres) {
+        /* from the pool as well, it is handed out like the decoded frame */
+        DSV_FRAME *tmp = dsv_pool_mk_frame(d->pool, subsamp, width, height, 0);
+
+        dsv_frame_copy(tmp, img->out_frame);
         draw_info(img, tmp, mvs, d->draw_info, p->has_ref);
         dsv_frame_ref_dec(img->out_frame);
         img->out_frame = tmp;
     }
 
     /* release resources */
-    if (coefs[0].data) { /* only the first pointer is actual allocated data */
-        dsv_free(coefs[0].data);
-        coefs[0].data = NULL;
-    }
+    dsv_pool_free_coefs(d->pool, coefs);
     if (is_ref) {
         if (d->ref) {
             img_unref(d->ref);
@@ -574,11 +1002,8 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
     }
 
     dsv_frame_ref_dec(residual);
-    if (mvs) {
-        dsv_free(mvs);
-    }
     if (buffer) {
-        dsv_buf_free(buffer);
+        release_buffer(d, buffer);
     }
 
     img_unref(img);
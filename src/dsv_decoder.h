@@ -41,7 +41,31 @@ typedef struct {
 #define DSV_DRAW_MOVECS 2 /* motion vectors */
 #define DSV_DRAW_IBLOCK 4 /* intra subblocks */
     int draw_info; /* set by user */
+#define DSV_FAST_INTRA 1 /* only decode intra pictures */
+#define DSV_FAST_THUMB 2 /* only decode intra pictures at 1/8 scale (lowres 3) */
+    /* set by user, skipped pictures are returned as DSV_DEC_SKIPPED.
+     * no reference is kept in these modes, switching back to a full decode
+     * takes effect at the next intra picture */
+    int fast;
+    /* set by user, decode at 1/2^lowres scale (up to DSV_MAX_LOWRES).
+     * the finest subband levels are left out and inter pictures are
+     * predicted from a scaled down reference, so they drift from a full
+     * size decode until the next intra picture. after a change, inter
+     * pictures fail to decode until the next intra picture */
+#define DSV_MAX_LOWRES 3
+    int lowres;
+    /* set by user, packet buffers passed to dsv_dec are not freed by it.
+     * allows decoding straight out of memory the decoder doesn't own */
+    int keep_buffers;
     int got_metadata;
+
+    struct DSV_SBT_SCRATCH *sbt_scratch;
+    struct DSV_POOL *pool;
+    DSV_MV *mvs; /* motion vectors of the picture being decoded */
+    int nmvs;
+    /* allocation context of this decoder, set mem.allocator before the
+     * first call to dsv_dec to use a custom allocator */
+    DSV_MEMORY mem;
 } DSV_DECODER;
 
 #define DSV_DEC_OK        0
@@ -49,8 +73,14 @@ typedef struct {
 #define DSV_DEC_EOS       2
 #define DSV_DEC_GOT_META  3
 #define DSV_DEC_NEED_NEXT 4
+#define DSV_DEC_SKIPPED   5 /* picture not decoded (fast mode), *fn is set */
 
-/* decode a buffer, returns a frame in *out and the frame number in *fn */
+/* decode a buffer, returns a frame in *out and the frame number in *fn.
+ * output frames are recycled through the decoder's frame pool, so their
+ * last dsv_frame_ref_dec must happen on the thread that calls dsv_dec
+ * (or be serialized with it and with each other, also after dsv_dec_free).
+ * copy it into a frame of your own (dsv_mk_frame + dsv_frame_copy) to
+ * hand a picture to another thread */
 extern int dsv_dec(DSV_DECODER *d, DSV_BUF *buf, DSV_FRAME **out, DSV_FNUM *fn);
 
 /* get the metadata that was decoded. NOTE: if no metadata has been decoded
@@ -60,6 +90,57 @@ extern DSV_META *dsv_get_metadata(DSV_DECODER *d);
 /* free anything the decoder was holding on to */
 extern void dsv_dec_free(DSV_DECODER *d);
 
+/* drop the reference picture so decoding can continue at an intra picture
+ * somewhere else in the stream. metadata is kept */
+extern void dsv_dec_flush(DSV_DECODER *d);
+
+/* Seek Index
+ *
+ * the B.1 link offsets make it possible to find every picture in a stream
+ * by reading packet headers only. pictures are numbered in stream order
+ * (frame numbers written by the encoder restart in joined streams).
+ */
+typedef struct {
+    DSV_OFFSET offset; /* byte offset of the picture packet */
+    DSV_OFFSET meta; /* offset of the last metadata packet before it, -1 if none */
+    DSV_FNUM fno;
+    int intra;
+    unsigned size; /* size of the picture packet, 0 if unknown */
+    int quality; /* encoder quality, -1 if unknown (only in trailers) */
+} DSV_INDEX_ENTRY;
+
+typedef struct {
+    DSV_INDEX_ENTRY *entries;
+    int n;
+    int cap;
+    DSV_OFFSET last_meta;
+} DSV_INDEX;
+
+/* bytes of a packet needed by dsv_index_packet */
+#define DSV_INDEX_PEEK (DSV_PACKET_HDR_SIZE + 4)
+
+extern void dsv_index_init(DSV_INDEX *idx);
+/* 'data' holds the first 'len' (up to DSV_INDEX_PEEK) bytes of the packet
+ * at 'offset'. returns its next link (the distance to the next packet),
+ * 0 at the end of the stream, -1 if it is not a packet, -2 if the index
+ * ran out of memory */
+extern DSV_OFFSET dsv_index_packet(DSV_INDEX *idx, uint8_t *data, unsigned len, DSV_OFFSET offset);
+/* returns the entry decoding has to start at to reach picture n,
+ * the closest intra picture at or before it. -1 if there is none */
+extern int dsv_index_seek(DSV_INDEX *idx, int n);
+extern void dsv_index_free(DSV_INDEX *idx);
+
+/* fill the index from a trailer packet (the packet before end of stream,
+ * see DSV_PT_TRAILER) that starts 'offset' bytes into the stream.
+ * returns 1 on success, 0 if the trailer does not describe the stream
+ * it is part of or the index ran out of memory */
+extern int dsv_index_trailer(DSV_INDEX *idx, uint8_t *data, unsigned len, DSV_OFFSET offset);
+
+/* sidecar files. an index is only read back if it was made for a stream
+ * of the same size, returns 1 on success */
+extern int dsv_index_write(DSV_INDEX *idx, FILE *out, DSV_OFFSET streamsz);
+extern int dsv_index_read(DSV_INDEX *idx, FILE *in, DSV_OFFSET streamsz);
+
 #ifdef __cplusplus
 }
 #endif
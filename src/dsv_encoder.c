@@ -15,6 +15,7 @@
 /*****************************************************************************/
 
 #include "dsv_encoder.h"
+#include "dsv_internal.h"
 
 #define RC_QUAL_PCT(pct) ((pct) * DSV_RC_QUAL_SCALE)
 
@@ -467,26 +468,30 @@ quality2quant(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_FNUM prev_I, int forced_intr
 }
 
 /* B.1 Packet Header Link Offsets */
-static void
-set_link_offsets(DSV_ENCODER *enc, DSV_BUF *buffer, int is_eos)
+extern void
+dsv_enc_set_links(uint8_t *data, unsigned prev_link, unsigned next_link)
 {
-    uint8_t *data = buffer->data;
-    unsigned next_link;
     unsigned prev_start = DSV_PACKET_PREV_OFFSET;
     unsigned next_start = DSV_PACKET_NEXT_OFFSET;
 
-    next_link = is_eos ? 0 : buffer->len;
-
-    data[prev_start + 0] = (enc->prev_link >> 24) & 0xff;
-    data[prev_start + 1] = (enc->prev_link >> 16) & 0xff;
-    data[prev_start + 2] = (enc->prev_link >>  8) & 0xff;
-    data[prev_start + 3] = (enc->prev_link >>  0) & 0xff;
+    data[prev_start + 0] = (prev_link >> 24) & 0xff;
+    data[prev_start + 1] = (prev_link >> 16) & 0xff;
+    data[prev_start + 2] = (prev_link >>  8) & 0xff;
+    data[prev_start + 3] = (prev_link >>  0) & 0xff;
 
     data[next_start + 0] = (next_link >> 24) & 0xff;
     data[next_start + 1] = (next_link >> 16) & 0xff;
     data[next_start + 2] = (next_link >>  8) & 0xff;
     data[next_start + 3] = (next_link >>  0) & 0xff;
+}
+
+static void
+set_link_offsets(DSV_ENCODER *enc, DSV_BUF *buffer, int is_eos)
+{
+    unsigned next_link;
 
+    next_link = is_eos ? 0 : buffer->len;
+    dsv_enc_set_links(buffer->data, enc->prev_link, next_link);
     enc->prev_link = next_link;
 }
 
@@ -503,7 +508,8 @@ mk_pyramid(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_FRAME **pyramid)
 
     prev = frame;
     for (i = 0; i < enc->pyramid_levels; i++) {
-        pyramid[i] = dsv_mk_frame(
+        pyramid[i] = dsv_pool_mk_frame(
+                enc->pool,
                 fmt,
                 DSV_ROUND_SHIFT(orig_w, i + 1),
                 DSV_ROUND_SHIFT(orig_h, i + 1),
@@ -703,7 +709,7 @@ encode_motion(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BS *bs, int *stats)
     upperbound = (params->nblocks_h * params->nblocks_v * 32);
 
     for (i = 0; i < DSV_SUB_NSUB; i++) {
-        bufs[i] = dsv_alloc(upperbound);
+        bufs[i] = dsv_alloc(&enc->mem, upperbound);
 
         if (i == DSV_SUB_MODE) {
             dsv_bs_init_rle(&rle, bufs[i]);
@@ -807,7 +813,7 @@ encode_stable_blocks(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BS *bs, DSV_MV *intra
     nblk = params->nblocks_h * params->nblocks_v;
     upperbound = (nblk * 32);
 
-    stabbuf = dsv_alloc(upperbound);
+    stabbuf = dsv_alloc(&enc->mem, upperbound);
     dsv_bs_init_rle(&stabrle, stabbuf);
 
     if (enc->refresh_ctr >= enc->stable_refresh) {
@@ -895,8 +901,8 @@ encode_intra_meta(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BS *bs, DSV_MV *intramv,
     nblk = params->nblocks_h * params->nblocks_v;
     upperbound = (nblk * 32);
 
-    buf_r = dsv_alloc(upperbound);
-    buf_m = dsv_alloc(upperbound);
+    buf_r = dsv_alloc(&enc->mem, upperbound);
+    buf_m = dsv_alloc(&enc->mem, upperbound);
     dsv_bs_init_rle(&rle_r, buf_r);
     dsv_bs_init_rle(&rle_m, buf_m);
 
@@ -956,7 +962,7 @@ encode_metadata(DSV_ENCODER *enc, DSV_BUF *buf)
     DSV_META *meta = &enc->vidmeta;
     unsigned next_start = DSV_PACKET_NEXT_OFFSET;
 
-    dsv_mk_buf(buf, 64);
+    dsv_mk_buf(&enc->mem, buf, 64);
 
     dsv_bs_init(&bs, buf->data);
 
@@ -1069,7 +1075,7 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
             break;
     }
 
-    dsv_mk_buf(output_buf, upperbound);
+    dsv_mk_buf(&enc->mem, output_buf, upperbound);
 
     dsv_bs_init(&bs, output_buf->data);
     /* B.2.3 Picture Packet */
@@ -1137,12 +1143,14 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
     fm.blockdata = enc->blockdata;
     fm.isP = d->params.has_ref;
     fm.fnum = d->fnum;
+    fm.lowres = 0;
+    fm.scratch = enc->sbt_scratch;
     if (fm.isP) {
         fm.mvs = d->final_mvs;
     } else {
         fm.mvs = intramv;
     }
-    dsv_mk_coefs(coefs, enc->vidmeta.subsamp, width, height);
+    dsv_pool_mk_coefs(enc->pool, coefs, enc->vidmeta.subsamp, width, height);
 
     /* encode the residual image */
     for (i = 0; i < 3; i++) {
@@ -1155,10 +1163,7 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
             dsv_intra_filter(d->quant, &d->params, &fm, i, &d->residual->planes[i], enc->do_intra_filter);
         }
     }
-    if (coefs[0].data) { /* only the first pointer is actual allocated data */
-        dsv_free(coefs[0].data);
-        coefs[0].data = NULL;
-    }
+    dsv_pool_free_coefs(enc->pool, coefs);
 
     dsv_bs_align(&bs);
 
@@ -1181,20 +1186,20 @@ size4dim(int dim)
     return DSV_MIN_BLOCK_SIZE;
 }
 
-static int
-encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
+/* source-only analysis stage.
+ * nothing in here depends on the reconstruction of any previous frame,
+ * only on the input frame and the encoder configuration.
+ */
+static void
+analyze_source(DSV_ENCODER *enc, DSV_ENCDATA *d)
 {
     DSV_PARAMS *p;
-    int i, w, h;
-    int gop_start = 0;
-    int forced_intra = 0;
-    DSV_FNUM prev_I;
+    int w, h;
 
     p = &d->params;
     p->vidmeta = &enc->vidmeta;
     p->effort = enc->effort;
     p->do_psy = enc->do_psy;
-    prev_I = enc->prev_gop;
     p->temporal_mc = DSV_TEMPORAL_MC(d->fnum);
     p->lossless = (enc->quality == DSV_RC_QUAL_MAX);
     w = p->vidmeta->width;
@@ -1222,8 +1227,8 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
     p->nblocks_v = DSV_UDIV_ROUND_UP(h, p->blk_h);
     DSV_DEBUG(("block size %dx%d", p->blk_w, p->blk_h));
     if (enc->stability == NULL) {
-        enc->stability = dsv_alloc(sizeof(*enc->stability) * p->nblocks_h * p->nblocks_v);
-        enc->blockdata = dsv_alloc(p->nblocks_h * p->nblocks_v);
+        enc->stability = dsv_alloc(&enc->mem, sizeof(*enc->stability) * p->nblocks_h * p->nblocks_v);
+        enc->blockdata = dsv_alloc(&enc->mem, p->nblocks_h * p->nblocks_v);
     }
 
     if (enc->pyramid_levels == 0) {
@@ -1240,9 +1245,25 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
         enc->pyramid_levels = CLAMP(lvls, 3, DSV_MAX_PYRAMID_LEVELS);
     }
 
-    DSV_DEBUG(("gop length %d", enc->gop));
-
     mk_pyramid(enc, d->padded_frame, d->pyramid);
+}
+
+/* reference-dependent coding stage, requires the previous frame
+ * (if any) to have been fully coded and reconstructed.
+ */
+static int
+encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
+{
+    DSV_PARAMS *p;
+    int i;
+    int gop_start = 0;
+    int forced_intra = 0;
+    DSV_FNUM prev_I;
+
+    p = &d->params;
+    prev_I = enc->prev_gop;
+
+    DSV_DEBUG(("gop length %d", enc->gop));
 
     if (enc->force_metadata || ((enc->prev_gop + enc->gop) <= d->fnum)) {
         gop_start = 1;
@@ -1273,7 +1294,7 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
 
     if (!d->params.has_ref) {
         if (!enc->intra_map) {
-            enc->intra_map = dsv_alloc(sizeof(*enc->intra_map) * p->nblocks_h * p->nblocks_v);
+            enc->intra_map = dsv_alloc(&enc->mem, sizeof(*enc->intra_map) * p->nblocks_h * p->nblocks_v);
         }
     } else {
         motion_est(enc, d);
@@ -1380,6 +1401,10 @@ dsv_enc_start(DSV_ENCODER *enc)
     enc->stats.pmins = INT_MAX;
 
     enc->force_metadata = 1;
+    /* luma is the largest plane in every format */
+    enc->sbt_scratch = dsv_sbt_new_scratch(&enc->mem);
+    dsv_sbt_alloc_scratch(enc->sbt_scratch, enc->vidmeta.width, enc->vidmeta.height);
+    enc->pool = dsv_pool_new(&enc->mem);
 }
 
 extern void
@@ -1398,6 +1423,21 @@ dsv_enc_free(DSV_ENCODER *enc)
         dsv_free(enc->blockdata);
         enc->blockdata = NULL;
     }
+    if (enc->intra_map) {
+        dsv_free(enc->intra_map);
+        enc->intra_map = NULL;
+    }
+    if (enc->trailer) {
+        dsv_free(enc->trailer);
+        enc->trailer = NULL;
+    }
+    enc->trailer_n = 0;
+    enc->trailer_cap = 0;
+    dsv_sbt_free_scratch(enc->sbt_scratch);
+    enc->sbt_scratch = NULL;
+    /* frames still referenced elsewhere free themselves when released */
+    dsv_pool_release(enc->pool);
+    enc->pool = NULL;
 }
 
 extern void
@@ -1412,19 +1452,118 @@ dsv_enc_force_metadata(DSV_ENCODER *enc)
     enc->force_metadata = 1;
 }
 
+/* keeps both enc->trailer and the packet encode_trailer makes (at most
+ * 25 bytes per picture) within the int sizes dsv_alloc takes */
+#define TRAILER_MAX_PICS (INT_MAX / 32)
+
+static void
+trailer_add(DSV_ENCODER *enc, DSV_FNUM fno, unsigned metasize, unsigned size, int intra)
+{
+    struct DSV_TRAILER_PIC *t;
+
+    if (enc->trailer_n == TRAILER_MAX_PICS) {
+        DSV_WARNING(("too many pictures to index, not writing a trailer"));
+        enc->write_trailer = 0;
+        return;
+    }
+    if (enc->trailer_n == enc->trailer_cap) {
+        struct DSV_TRAILER_PIC *grown;
+
+        enc->trailer_cap = enc->trailer_cap ? enc->trailer_cap * 2 : 256;
+        if (enc->trailer_cap > TRAILER_MAX_PICS) {
+            enc->trailer_cap = TRAILER_MAX_PICS;
+        }
+        grown = dsv_alloc(&enc->mem, enc->trailer_cap * sizeof(*grown));
+        if (enc->trailer) {
+            memcpy(grown, enc->trailer, enc->trailer_n * sizeof(*grown));
+            dsv_free(enc->trailer);
+        }
+        enc->trailer = grown;
+    }
+    if (enc->trailer_n == 0) {
+        enc->trailer_fno = fno;
+    }
+    t = &enc->trailer[enc->trailer_n++];
+    t->metasize = metasize;
+    t->size = size;
+    t->quality = enc->rc_qual;
+    t->intra = intra;
+}
+
+/* Trailer Packet, not part of the v8 spec and skipped by decoders.
+ *
+ * ueg  number of pictures
+ * ueg  frame number of the first picture
+ * per picture:
+ *   bit  intra
+ *   ueg  size of the metadata packet sent right before it, 0 if none
+ *   ueg  size of the picture packet
+ *   ueg  quality (0...DSV_RC_QUAL_MAX)
+ *
+ * the byte offset of every packet follows from the sizes since the
+ * stream starts with the first metadata packet. the trailer is always the
+ * packet right before end of stream so its prev link leads to it from
+ * the end of the file.
+ */
+static void
+encode_trailer(DSV_ENCODER *enc, DSV_BUF *buf)
+{
+    DSV_BS bs;
+    int i;
+
+    /* an exp-Golomb coded 32-bit value takes at most 65 bits */
+    dsv_mk_buf(&enc->mem, buf, DSV_PACKET_HDR_SIZE + 2 * 9 + enc->trailer_n * 25);
+    dsv_bs_init(&bs, buf->data);
+
+    encode_packet_hdr(&bs, DSV_PT_TRAILER);
+
+    dsv_bs_put_ueg(&bs, enc->trailer_n);
+    dsv_bs_put_ueg(&bs, enc->trailer_fno);
+    for (i = 0; i < enc->trailer_n; i++) {
+        struct DSV_TRAILER_PIC *t = &enc->trailer[i];
+
+        dsv_bs_put_bit(&bs, t->intra);
+        dsv_bs_put_ueg(&bs, t->metasize);
+        dsv_bs_put_ueg(&bs, t->size);
+        dsv_bs_put_ueg(&bs, t->quality);
+    }
+    dsv_bs_align(&bs);
+    buf->len = dsv_bs_ptr(&bs); /* trim length to actual size */
+}
+
 /* B.2.2 End of Stream Packet */
-extern void
-dsv_enc_end_of_stream(DSV_ENCODER *enc, DSV_BUF *bufs)
+static void
+encode_eos(DSV_MEMORY *mem, DSV_BUF *buf)
 {
     DSV_BS bs;
 
-    dsv_mk_buf(&bufs[0], DSV_PACKET_HDR_SIZE);
-    dsv_bs_init(&bs, bufs[0].data);
+    dsv_mk_buf(mem, buf, DSV_PACKET_HDR_SIZE);
+    dsv_bs_init(&bs, buf->data);
 
     encode_packet_hdr(&bs, DSV_PT_EOS);
+}
+
+extern void
+dsv_enc_mk_eos(DSV_MEMORY *mem, DSV_BUF *buf, unsigned prev_link)
+{
+    encode_eos(mem, buf);
+    dsv_enc_set_links(buf->data, prev_link, 0);
+}
+
+extern int
+dsv_enc_end_of_stream(DSV_ENCODER *enc, DSV_BUF *bufs)
+{
+    int nbuf = 0;
 
-    set_link_offsets(enc, &bufs[0], 1);
+    if (enc->write_trailer && enc->trailer_n > 0) {
+        encode_trailer(enc, &bufs[nbuf++]);
+        set_link_offsets(enc, &bufs[nbuf - 1], 0);
+        DSV_INFO(("creating trailer packet for %d pictures", enc->trailer_n));
+    }
+    encode_eos(&enc->mem, &bufs[nbuf++]);
+    set_link_offsets(enc, &bufs[nbuf - 1], 1);
     DSV_INFO(("creating end of stream packet"));
+    return nbuf;
 }
 
 extern int
@@ -1443,21 +1582,30 @@ dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
         DSV_ERROR(("null buffer list passed to encoder!"));
         return 0;
     }
-    d = dsv_alloc(sizeof(DSV_ENCDATA));
+    d = dsv_alloc(&enc->mem, sizeof(DSV_ENCDATA));
 
     d->refcount = 1;
+    d->params.mem = &enc->mem;
 
     w = enc->vidmeta.width;
     h = enc->vidmeta.height;
-    d->residual = dsv_mk_frame(enc->vidmeta.subsamp, w, h, 1);
-    d->prediction = dsv_mk_frame(enc->vidmeta.subsamp, w, h, 1);
-
-    d->padded_frame = dsv_clone_frame(frame, 1);
-    dsv_extend_frame(d->padded_frame);
-    dsv_frame_ref_dec(frame);
+    d->residual = dsv_pool_mk_frame(enc->pool, enc->vidmeta.subsamp, w, h, 1);
+    d->prediction = dsv_pool_mk_frame(enc->pool, enc->vidmeta.subsamp, w, h, 1);
+
+    if (frame->border) {
+        /* the caller's frame already has room for a border, use it in place.
+         * it is held (and the caller's release callback delayed) for as
+         * long as it is needed as the source reference */
+        d->padded_frame = dsv_extend_frame(frame);
+    } else {
+        d->padded_frame = dsv_pool_mk_frame(enc->pool, frame->format, frame->width, frame->height, 1);
+        dsv_frame_copy(d->padded_frame, frame); /* also extends the border */
+        dsv_frame_ref_dec(frame);
+    }
 
     d->fnum = enc->next_fnum++;
 
+    analyze_source(enc, d);
     if (encode_one_frame(enc, d, &outbuf)) {
         DSV_BUF metabuf;
         encode_metadata(enc, &metabuf);
@@ -1467,6 +1615,9 @@ dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
     }
     bufs[nbuf++] = outbuf;
     set_link_offsets(enc, &bufs[nbuf - 1], 0);
+    if (enc->write_trailer) {
+        trailer_add(enc, d->fnum, nbuf > 1 ? bufs[0].len : 0, outbuf.len, !d->params.has_ref);
+    }
 
     if (d->params.has_ref) {
         int i, j;
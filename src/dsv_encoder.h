@@ -21,7 +21,9 @@
 extern "C" {
 #endif
 
-#include "dsv_internal.h"
+#include "dsv.h"
+
+#include <limits.h>
 
 #define DSV_ENCODER_VERSION 14
 
@@ -112,6 +114,9 @@ typedef struct {
     int scene_change_pct;
     unsigned stable_refresh; /* # frames after which stability accum resets */
     int pyramid_levels;
+    /* write a trailer packet before end of stream that indexes the pictures
+     * (sizes, qualities, intra frames) so tools can seek without scanning */
+    int write_trailer;
 
     struct DSV_STATS {
         unsigned inum; /* num I frames */
@@ -185,6 +190,22 @@ typedef struct {
 
     DSV_FNUM prev_gop;
     int prev_quant;
+
+    struct DSV_TRAILER_PIC {
+        unsigned metasize; /* size of the metadata packet before it, or 0 */
+        unsigned size;
+        unsigned quality;
+        int intra;
+    } *trailer;
+    int trailer_n;
+    int trailer_cap;
+    DSV_FNUM trailer_fno; /* number of the first picture */
+
+    struct DSV_SBT_SCRATCH *sbt_scratch;
+    struct DSV_POOL *pool;
+    /* allocation context of this encoder, set mem.allocator after
+     * dsv_enc_init to use a custom allocator */
+    DSV_MEMORY mem;
 } DSV_ENCODER;
 
 extern void dsv_enc_init(DSV_ENCODER *enc);
@@ -196,7 +217,16 @@ extern void dsv_enc_start(DSV_ENCODER *enc);
 
 /* returns number of buffers available in bufs ptr */
 extern int dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs);
-extern void dsv_enc_end_of_stream(DSV_ENCODER *enc, DSV_BUF *bufs);
+/* returns number of buffers available in bufs ptr,
+ * 2 (trailer and end of stream) when write_trailer is set */
+extern int dsv_enc_end_of_stream(DSV_ENCODER *enc, DSV_BUF *bufs);
+
+/* for tools that write streams out of already encoded packets (dsv2 j).
+ * dsv_enc_set_links rewrites the B.1 link offsets of the packet at 'data',
+ * dsv_enc_mk_eos makes an end of stream packet that follows a packet
+ * 'prev_link' bytes before it */
+extern void dsv_enc_set_links(uint8_t *data, unsigned prev_link, unsigned next_link);
+extern void dsv_enc_mk_eos(DSV_MEMORY *mem, DSV_BUF *buf, unsigned prev_link);
 
 /* used internally */
 typedef struct {
@@ -208,6 +238,7 @@ typedef struct {
     DSV_MV *ref_mvf;
     DSV_MV mv_bank[128];
     int n_mv_bank_used;
+    int pred_x, pred_y; /* motion vector predictor of the current block */
     DSV_ENCODER *enc;
     int quant;
 } DSV_HME;
@@ -35,7 +35,26 @@ extern "C" {
 #define DSV_SUB_EPRM 4 /* expanded prediction range mode */
 #define DSV_SUB_NSUB 5
 
-#define DSV_FRAME_BORDER DSV_MAX_BLOCK_SIZE
+typedef struct DSV_SBT_SCRATCH {
+    DSV_SBC *data;
+    int size; /* in number of coefficients */
+    DSV_MEMORY *mem; /* context 'data' is allocated from */
+} DSV_SBT_SCRATCH; /* subband transform scratch, owned by a codec instance */
+
+/* recycles frames and coefficient planes of an encoder or decoder instead
+ * of allocating (and zeroing) new ones for every picture */
+#define DSV_POOL_SLOTS 16
+
+typedef struct DSV_POOL {
+    DSV_FRAME *frames[DSV_POOL_SLOTS]; /* idle frames, most recent last */
+    int nframes;
+    DSV_SBC *coefs[DSV_POOL_SLOTS]; /* idle coefficient planes, same order */
+    int coefs_len[DSV_POOL_SLOTS];
+    int ncoefs;
+    DSV_FRAME *live; /* frames handed out that have not come back yet */
+    int closed; /* owner released the pool */
+    DSV_MEMORY *mem; /* context everything in the pool is allocated from */
+} DSV_POOL;
 
 typedef struct {
     DSV_PARAMS *params;
@@ -43,15 +62,21 @@ typedef struct {
     uint8_t *blockdata; /* block bitmasks for adaptive things */
     uint8_t cur_plane;
     uint8_t isP; /* is P frame */
+    uint8_t lowres; /* decoder only, number of finest levels left out (1/2^n scale) */
     DSV_FNUM fnum;
+    DSV_SBT_SCRATCH *scratch;
 } DSV_FMETA; /* frame metadata */
 
 typedef struct {
     uint8_t *start;
     unsigned pos;
+    unsigned end; /* readable size in bytes */
+    int err; /* sticky, set when a read went past 'end' */
 } DSV_BS;
 
 extern void dsv_bs_init(DSV_BS *bs, uint8_t *buffer);
+/* reader that will not read past 'len' bytes of 'buffer' */
+extern void dsv_bs_init_read(DSV_BS *bs, uint8_t *buffer, unsigned len);
 
 extern void dsv_bs_align(DSV_BS *bs);
 
@@ -60,6 +85,7 @@ extern void dsv_bs_align(DSV_BS *bs);
 #define dsv_bs_ptr(bs) ((bs)->pos / 8)
 #define dsv_bs_set(bs, ptr) ((bs)->pos = (ptr) * 8)
 #define dsv_bs_skip(bs, n_bytes) ((bs)->pos += (n_bytes) * 8)
+#define dsv_bs_error(bs) ((bs)->err)
 
 extern void dsv_bs_concat(DSV_BS *bs, uint8_t *data, int len);
 
@@ -111,6 +137,28 @@ extern int dsv_bs_get_nrice(DSV_BS *bs, int *rk, int damp);
 
 extern void dsv_fwd_sbt(DSV_PLANE *src, DSV_COEFS *dst, DSV_FMETA *fm);
 extern void dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, DSV_FMETA *fm);
+extern DSV_SBT_SCRATCH *dsv_sbt_new_scratch(DSV_MEMORY *mem);
+extern void dsv_sbt_alloc_scratch(DSV_SBT_SCRATCH *s, int width, int height);
+extern void dsv_sbt_free_scratch(DSV_SBT_SCRATCH *s);
+
+/* buffers handed out by a pool are not cleared when they are reused.
+ * a NULL pool falls back to plain (zeroed) allocation */
+/* stop counting a block in the statistics of the context it came from,
+ * for blocks that may outlive the context */
+extern void dsv_alloc_detach(void *ptr);
+
+extern DSV_POOL *dsv_pool_new(DSV_MEMORY *mem);
+extern void dsv_pool_release(DSV_POOL *pool);
+extern DSV_FRAME *dsv_pool_mk_frame(DSV_POOL *pool, int format, int width, int height, int border);
+extern void dsv_pool_mk_coefs(DSV_POOL *pool, DSV_COEFS *c, int format, int width, int height);
+extern void dsv_pool_free_coefs(DSV_POOL *pool, DSV_COEFS *c);
+
+#if DSV_MEMORY_STATS
+extern void dsv_memory_pool_stat(DSV_MEMORY *mem, int hit);
+#define DSV_POOL_STAT(mem, hit) dsv_memory_pool_stat(mem, hit)
+#else
+#define DSV_POOL_STAT(mem, hit)
+#endif
 
 extern void dsv_encode_plane(DSV_BS *bs, DSV_COEFS *src, int q, DSV_FMETA *fm);
 extern int dsv_decode_plane(DSV_BS *bs, DSV_COEFS *dst, int q, DSV_FMETA *fm);
@@ -118,6 +166,7 @@ extern int dsv_decode_plane(DSV_BS *bs, DSV_COEFS *dst, int q, DSV_FMETA *fm);
 extern int dsv_lb2(unsigned n);
 
 extern int dsv_mv_cost(DSV_MV *vecs, DSV_PARAMS *p, int i, int j, int mx, int my, int q, int sqr);
+extern int dsv_mv_cost_pred(DSV_PARAMS *p, int px, int py, int mx, int my, int q, int sqr);
 extern void dsv_movec_pred(DSV_MV *vecs, DSV_PARAMS *p, int x, int y, int *px, int *py);
 extern void dsv_neighbordif2(DSV_MV *vecs, DSV_PARAMS *p, int x, int y, int *dx, int *dy);
 extern int dsv_neighbordif(DSV_MV *vecs, DSV_PARAMS *p, int x, int y);
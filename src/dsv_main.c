@@ -17,6 +17,7 @@
 #include "dsv.h"
 #include "dsv_encoder.h"
 #include "dsv_decoder.h"
+#include "dsv_internal.h"
 #include "util.h"
 
 #include <stdio.h>
@@ -133,9 +134,18 @@ static struct PARAM enc_params[] = {
     { "sfr", 0, 0, INT_MAX, NULL,
             "frame number to start compressing at. 0 = default",
             "if piping in from stdin, it will read+skip 'sfr' frames of the piped input before it starts encoding"},
+    { "mmap", 1, 0, 1, NULL,
+            "memory map the input file when possible. 0 = disabled, 1 = enabled, 1 = default",
+            "frames are encoded straight out of the mapping and -sfr seeks instantly, pipes always use regular reads"},
+    { "rdahead", 4, 0, 64, NULL,
+            "number of frames a program piping into the encoder may run ahead of it. 0 = system default, 4 = default",
+            "lets the program producing the input keep working while a frame is being encoded. bounded by the system pipe size limit"},
     { "noeos", 0, 0, 1, NULL,
             "do not write EOS packet at the end of the compressed stream. 0 = default",
-            "useful for multithreaded encoding via concatenation"},
+            "useful for multithreaded encoding via concatenation, see the j (join) mode"},
+    { "trailer", 0, 0, 1, NULL,
+            "write a trailer packet that indexes the pictures right before the EOS packet. 0 = default",
+            "lets the decoder (-sfr) and other tools seek in the stream without scanning it. decoders that do not know it skip it"},
     { "fps_num", 30, 1, (1 << 24), NULL,
             "fps numerator of input video. 30 = default",
             "used for rate control in ABR mode, otherwise it's just metadata for playback"},
@@ -227,6 +237,12 @@ static struct PARAM enc_params[] = {
     { "psharp", 1, 0, 1, NULL,
             "inter frame sharpening. 0 = disabled, 1 = enabled, 1 = default",
             "smart image sharpening, helps reduce blurring in motion"},
+    { "wbuf", 256, 0, (1 << 20), NULL,
+            "size of the output write buffer in kilobytes. 0 = C library default. 256 = default",
+            "packets are written out as soon as they are encoded, this bounds how much compressed data is held in memory before being written"},
+    { "flush", 0, 0, INT_MAX, NULL,
+            "flush the output (and sync it to disk where supported) every n frames. 0 = only when the write buffer is full. 0 = default",
+            "useful for reducing latency when piping the output into another program"},
     { NULL, 0, 0, 0, NULL, "", "" }
 };
 
@@ -243,6 +259,27 @@ static struct PARAM dec_params[] = {
     { "drawinfo", 0, 0, (DSV_DRAW_STABHQ | DSV_DRAW_MOVECS | DSV_DRAW_IBLOCK), NULL,
             "draw debugging information on the decoded frames (bit OR together to get multiple at the same time):\n\t\t1 = draw stability info\n\t\t2 = draw motion vectors\n\t\t4 = draw intra subblocks. 0 = default",
             NULL},
+    { "fast", 0, 0, DSV_FAST_THUMB, NULL,
+            "fast decoding for thumbnails and scrubbing. 0 = decode every frame, 1 = only decode intra frames, 2 = only decode intra frames at 1/8 scale. 0 = default",
+            "inter frames are skipped by their packet type alone. -sfr/-nfr still count them"},
+    { "scale", 0, 0, DSV_MAX_LOWRES, NULL,
+            "decode at reduced resolution. 0 = full size, 1 = 1/2, 2 = 1/4, 3 = 1/8 size. 0 = default",
+            "the finest subbands are not reconstructed and inter frames are predicted at the reduced size, output drifts slightly from a full size decode between intra frames"},
+    { "sfr", 0, 0, INT_MAX, NULL,
+            "frame (in stream order) to start decoding at. 0 = default",
+            "seeks to the closest intra frame before it using the packet links, if reading from stdin it will decode+skip 'sfr' frames"},
+    { "nfr", -1, -1, INT_MAX, NULL,
+            "number of frames to decode. -1 means as many as possible. -1 = default",
+            NULL},
+    { "sidx", 0, 0, 1, NULL,
+            "keep the seek index in a sidecar file (input path + .idx). 0 = disabled, 1 = enabled, 0 = default",
+            "saves scanning the stream again the next time it is seeked in"},
+    { "wbuf", 1024, 0, (1 << 20), NULL,
+            "size of the output write buffer in kilobytes. 0 = C library default. 1024 = default",
+            "frames are written in fewer, larger writes"},
+    { "outq", 4, 0, 64, NULL,
+            "number of decoded frames that may be queued for a program reading the output from a pipe. 0 = system default, 4 = default",
+            "lets the decoder keep decoding while the program reading the output catches up. bounded by the system pipe size limit"},
     { NULL, 0, 0, 0, NULL, "", "" }
 };
 
@@ -270,9 +307,10 @@ usage_general(void)
     char *p = progname;
 
     printf(DRV_HEADER);
-    printf("usage: %s <e|d> [options]\n", p);
+    printf("usage: %s <e|d|j> [options]\n", p);
     printf("for more information about running the encoder: %s e help\n", p);
     printf("for more information about running the decoder: %s d help\n", p);
+    printf("for more information about joining encoded chunks: %s j help\n", p);
     printf("for verbose information about encoder parameters: %s e vhelp\n", p);
     printf("for verbose information about decoder parameters: %s d vhelp\n", p);
 }
@@ -322,6 +360,25 @@ usage_decoder(int extra)
     print_params(dec_params, extra);
 }
 
+static void
+usage_join(void)
+{
+    char *p = progname;
+
+    printf(DRV_HEADER);
+    printf("usage: %s j [options] <chunk.dsv> [chunk.dsv ...]\n", p);
+    printf("sample usage: %s j -out=joined.dsv part1.dsv part2.dsv part3.dsv\n", p);
+    printf("------------------------------------------------------------\n");
+    printf("\tjoins separately encoded chunks (e.g -sfr/-nfr ranges of the same source)\n");
+    printf("\tinto one stream. the packet link offsets are fixed up across chunk boundaries,\n");
+    printf("\tinner end of stream packets are dropped and a single one is written at the end.\n");
+    printf("\tchunks should start on a GOP boundary and be encoded with identical settings.\n");
+    printf("\t-out= : output file. NOTE: if not specified, defaults to stdout\n");
+    printf("\t-y : do not prompt for confirmation when potentially overwriting an existing file\n");
+    printf("\t-l<n> : set logging level to n (0 = none, 1 = error, 2 = warning, 3 = info, 4 = debug/all)\n");
+    printf("\t-v : set verbose\n");
+}
+
 static void
 usage(int extra)
 {
@@ -494,60 +551,65 @@ init_params(int argc, char **argv)
     return 1;
 }
 
-static uint8_t *enc_buf = NULL;
-static unsigned bufsz = 0;
+/* packets are written out as soon as the encoder returns them */
+static FILE *enc_out = NULL;
+static DSV_OFFSET bufsz = 0; /* total number of bytes written */
 
-static uint8_t *
-mrealloc(uint8_t *p, unsigned sz)
+static int
+openoutput(char *n, int wbuf_kb)
 {
-    if (p == NULL) {
-        return malloc(sz);
+    if (n[0] == USE_STDIO_CHAR) {
+        enc_out = stdout;
+    } else {
+        enc_out = fopen(n, "wb");
+        if (enc_out == NULL) {
+            perror("unable to open file");
+            return 0;
+        }
     }
-    return realloc(p, sz);
+    /* stdout may have been written to already if verbose */
+    if (wbuf_kb > 0 && (enc_out != stdout || !verbose)) {
+        setvbuf(enc_out, NULL, _IOFBF, (size_t) wbuf_kb * 1024);
+    }
+    return 1;
 }
 
-static void
+static int
 savebuffer(DSV_BUF *buffer)
 {
-    enc_buf = mrealloc(enc_buf, bufsz + buffer->len);
-    memcpy(enc_buf + bufsz, buffer->data, buffer->len);
+    if (fwrite(buffer->data, 1, buffer->len, enc_out) != buffer->len) {
+        perror("unable to write file");
+        return 0;
+    }
     bufsz += buffer->len;
+    return 1;
 }
 
 static int
-writefile(char *n, unsigned char *buf, long len)
+closeoutput(void)
 {
-    FILE *fp;
+    int ok = 1;
 
-    if (n[0] == USE_STDIO_CHAR) {
-        fp = stdout;
-    } else {
-        fp = fopen(n, "wb");
-        if (fp == NULL) {
-            perror("unable to open file");
-            return 0;
-        }
+    if (enc_out == NULL) {
+        return 0;
     }
-    if (fwrite(buf, 1, len, fp) != (unsigned) len) {
+    if (fflush(enc_out) != 0) {
         perror("unable to write file");
-        goto err;
-    }
-
-    if (n[0] != USE_STDIO_CHAR) {
-        fclose(fp);
+        ok = 0;
     }
-    return 1;
-err:
-    if (n[0] != USE_STDIO_CHAR) {
-        fclose(fp);
+    if (enc_out != stdout) {
+        fclose(enc_out);
     }
-    return 0;
+    enc_out = NULL;
+    return ok;
 }
 
 static int
 encode(void)
 {
-    uint8_t *picture;
+    uint8_t *picture = NULL;
+    DSV_INPUT_MAP map;
+    int mapped = 0;
     DSV_BUF bufs[4];
     DSV_FRAME *frame;
     DSV_META md;
@@ -557,10 +619,11 @@ encode(void)
     int maxframe;
     FILE *inpfile;
     unsigned frno = 0, total_frames = 0, skip_frames = 0;
-    int nfr;
+    int nfr, flush_interval;
     int y4m_in = 0;
     int write_eos = 1;
     int no_more_data = 0;
+    int write_err = 0;
     size_t full_hdrsz = 0;
 
     if (verbose) {
@@ -631,8 +694,31 @@ encode(void)
     }
     dsv_enc_set_metadata(&enc, &md);
 
+    memset(&map, 0, sizeof(map));
+    if (get_optval(enc_params, "mmap")) {
+        size_t start = full_hdrsz;
+
+        if (!y4m_in) {
+            long pos = ftell(inpfile);
+            start = pos > 0 ? pos : 0;
+        }
+        mapped = dsv_input_map(&map, inpfile, start, y4m_in, w, h, md.subsamp);
+        if (mapped && verbose) {
+            printf("memory mapped input, %d frames\n", map.nframes);
+        }
+    }
+    if (!mapped) {
+        size_t pipesz;
+
+        pipesz = dsv_pipe_reserve(inpfile, get_optval(enc_params, "rdahead"), w, h, md.subsamp);
+        if (pipesz && verbose) {
+            printf("input pipe holds %u bytes\n", (unsigned) pipesz);
+        }
+    }
 #define EXTRA_PAD 1
-    picture = malloc(w * h * (3 + EXTRA_PAD)); /* allocate extra to be safe */
+    if (!mapped) {
+        picture = malloc(w * h * (3 + EXTRA_PAD)); /* allocate extra to be safe */
+    }
 
     enc.gop = get_optval(enc_params, "gop");
     if (enc.gop < 0) {
@@ -725,12 +811,20 @@ encode(void)
     frno = get_optval(enc_params, "sfr");
     nfr = get_optval(enc_params, "nfr");
     write_eos = !get_optval(enc_params, "noeos");
+    enc.write_trailer = get_optval(enc_params, "trailer");
     if (nfr > 0) {
         maxframe = frno + nfr;
     } else {
         maxframe = -1;
     }
 
+    flush_interval = get_optval(enc_params, "flush");
+    if (!openoutput(opts.out, get_optval(enc_params, "wbuf"))) {
+        free(picture);
+        dsv_input_unmap(&map);
+        return EXIT_FAILURE;
+    }
+
     DSV_INFO(("starting encoder"));
     dsv_enc_start(&enc);
     run = 1;
@@ -741,7 +835,15 @@ encode(void)
         if (maxframe > 0 && frno >= (unsigned) maxframe) {
             goto end_of_stream;
         }
-        if (y4m_in) {
+        if (mapped) {
+            uint8_t *data = dsv_input_map_frame(&map, frno);
+
+            if (data == NULL) {
+                no_more_data = 1;
+                goto end_of_stream;
+            }
+            frame = dsv_load_planar_frame(NULL, md.subsamp, data, w, h);
+        } else if (y4m_in) {
             if (opts.inp[0] == USE_STDIO_CHAR) {
                 frame_read = dsv_y4m_read_seq(inpfile, picture, w, h, md.subsamp);
                 if (skip_frames++ < frno) {
@@ -767,7 +869,9 @@ encode(void)
             no_more_data = 1;
             goto end_of_stream;
         }
-        frame = dsv_load_planar_frame(md.subsamp, picture, w, h);
+        if (!mapped) {
+            frame = dsv_load_planar_frame(NULL, md.subsamp, picture, w, h);
+        }
         if (verbose) {
             printf("encoding frame %d\r", frno);
             fflush(stdout);
@@ -787,31 +891,51 @@ encode(void)
             fflush(stdout);
         }
         for (i = 0; i < state; i++) {
-            savebuffer(&bufs[i]);
+            if (!write_err && !savebuffer(&bufs[i])) {
+                write_err = 1;
+            }
             dsv_buf_free(&bufs[i]);
         }
         frno++;
         total_frames++;
+        if (write_err) {
+            break;
+        }
+        if (flush_interval > 0 && (total_frames % flush_interval) == 0) {
+            if (dsv_file_sync(enc_out) != 0) {
+                perror("unable to write file");
+                write_err = 1;
+                break;
+            }
+        }
         continue;
 end_of_stream:
         if (write_eos || (!write_eos && no_more_data && bufsz > 0)) {
-            dsv_enc_end_of_stream(&enc, bufs);
-            savebuffer(&bufs[0]);
-            dsv_buf_free(&bufs[0]);
+            int nbuf = dsv_enc_end_of_stream(&enc, bufs);
+
+            for (i = 0; i < nbuf; i++) {
+                if (!write_err && !savebuffer(&bufs[i])) {
+                    write_err = 1;
+                }
+                dsv_buf_free(&bufs[i]);
+            }
         }
         break;
     }
+    if (!closeoutput()) {
+        write_err = 1;
+    }
 
     if (verbose) {
         /* KBps = kiloBYTES, kbps = kiloBITS */
         int bpf, bps, kbps, mbps;
 
-        bpf = (bufsz * 8) / total_frames;
+        bpf = (int) ((bufsz * 8) / total_frames);
         bps = bpf * fps;
         kbps = bps / 1024;
         mbps = kbps / 1024;
-        printf("\nencoded %d bytes @ %d bps, %d kbps, %d KBps, %d mbps. fps = %d, bpf = %d\n",
-                bufsz, bps, kbps, kbps / 8, mbps, fps, bpf);
+        printf("\nencoded %.0f bytes @ %d bps, %d kbps, %d KBps, %d mbps. fps = %d, bpf = %d\n",
+                (double) bufsz, bps, kbps, kbps / 8, mbps, fps, bpf);
         if (enc.rc_mode == DSV_RATE_CONTROL_ABR) {
             printf("target bitrate = %d bps  %d KBps  %d kbps\n",
                     enc.bitrate, enc.bitrate / (8 * 1024), enc.bitrate / 1024);
@@ -892,15 +1016,20 @@ end_of_stream:
         }
     }
 
-    writefile(opts.out, enc_buf, bufsz);
-    if (verbose) {
+    if (verbose && !write_err) {
         printf("saved video file\n");
     }
     dsv_enc_free(&enc);
+    dsv_memory_report(&enc.mem);
+    free(picture);
+    dsv_input_unmap(&map);
 
     if (opts.inp[0] != USE_STDIO_CHAR) {
         fclose(inpfile);
     }
+    if (write_err) {
+        return EXIT_FAILURE;
+    }
     return no_more_data ? -2 : EXIT_SUCCESS;
 }
 
@@ -944,7 +1073,7 @@ read_packet(FILE *f, DSV_BUF *rb, int *packet_type)
         return DSV_PKT_ERR_PSZ;
     }
     *packet_type = hdr[DSV_PACKET_TYPE_OFFSET];
-    dsv_mk_buf(rb, size);
+    dsv_mk_buf(NULL, rb, size);
     memcpy(rb->data, hdr, DSV_PACKET_HDR_SIZE);
     n = fread(rb->data + DSV_PACKET_HDR_SIZE, 1, size - DSV_PACKET_HDR_SIZE, f);
     if (n < size - DSV_PACKET_HDR_SIZE) {
@@ -956,6 +1085,129 @@ read_packet(FILE *f, DSV_BUF *rb, int *packet_type)
     return 1;
 }
 
+/* builds the seek index by walking the B.1 next links from the start.
+ * returns 0 if it ran out of memory before reaching the end */
+static int
+scan_index(FILE *f, DSV_INDEX *idx)
+{
+    uint8_t peek[DSV_INDEX_PEEK];
+    DSV_OFFSET pos = 0, next;
+    unsigned n;
+
+    while (dsv_file_seek(f, pos) == 0) {
+        n = fread(peek, 1, DSV_INDEX_PEEK, f);
+        if (n == 0) {
+            break;
+        }
+        next = dsv_index_packet(idx, peek, n, pos);
+        if (next == -2) {
+            DSV_WARNING(("out of memory, index ends at offset %.0f", (double) pos));
+            return 0;
+        }
+        if (next < 0) {
+            DSV_WARNING(("bad packet at offset %.0f, index ends there", (double) pos));
+            break;
+        }
+        if (next == 0) {
+            break;
+        }
+        pos += next;
+    }
+    return 1;
+}
+
+/* reads the packet header at pos, returns its type or -1 */
+static int
+peek_packet(FILE *f, DSV_OFFSET pos, uint8_t *hdr)
+{
+    if (dsv_file_seek(f, pos) ||
+        fread(hdr, 1, DSV_PACKET_HDR_SIZE, f) != DSV_PACKET_HDR_SIZE ||
+        hdr[0] != DSV_FOURCC_0 || hdr[1] != DSV_FOURCC_1 ||
+        hdr[2] != DSV_FOURCC_2 || hdr[3] != DSV_FOURCC_3) {
+        return -1;
+    }
+    return hdr[DSV_PACKET_TYPE_OFFSET];
+}
+
+/* finds the trailer from the end of the stream, the EOS packet's prev link
+ * points at it. returns 1 if it filled the index */
+static int
+read_trailer(FILE *f, DSV_OFFSET size, DSV_INDEX *idx)
+{
+    uint8_t hdr[DSV_PACKET_HDR_SIZE];
+    DSV_BUF buffer;
+    DSV_OFFSET pos;
+    unsigned link;
+    int packet_type, ok;
+
+    pos = size - DSV_PACKET_HDR_SIZE;
+    if (peek_packet(f, pos, hdr) != DSV_PT_EOS) {
+        return 0;
+    }
+    link = (hdr[DSV_PACKET_PREV_OFFSET + 0] << 24) |
+           (hdr[DSV_PACKET_PREV_OFFSET + 1] << 16) |
+           (hdr[DSV_PACKET_PREV_OFFSET + 2] << 8) |
+           (hdr[DSV_PACKET_PREV_OFFSET + 3]);
+    if (link < DSV_PACKET_HDR_SIZE || link > pos) {
+        return 0;
+    }
+    pos -= link;
+    if (peek_packet(f, pos, hdr) != DSV_PT_TRAILER ||
+        dsv_file_seek(f, pos) || read_packet(f, &buffer, &packet_type) < 0) {
+        return 0;
+    }
+    ok = dsv_index_trailer(idx, buffer.data, buffer.len, pos);
+    dsv_buf_free(&buffer);
+    if (ok) {
+        DSV_INFO(("using the trailer index (%d pictures)", idx->n));
+    }
+    return ok;
+}
+
+static void
+load_index(FILE *f, char *path, int sidecar, DSV_INDEX *idx)
+{
+    FILE *sf;
+    char *name;
+    DSV_OFFSET size;
+
+    /* without 64 bit file positioning streams past 2 GB fail here */
+    if ((size = dsv_file_size(f)) < 0) {
+        DSV_WARNING(("could not get the stream size, no seek index"));
+        return;
+    }
+    if (read_trailer(f, size, idx)) {
+        return;
+    }
+    if (!sidecar) {
+        scan_index(f, idx);
+        return;
+    }
+    name = malloc(strlen(path) + 5);
+    if (name == NULL) {
+        DSV_WARNING(("out of memory, not using a sidecar index"));
+        scan_index(f, idx);
+        return;
+    }
+    sprintf(name, "%s.idx", path);
+    sf = fopen(name, "r");
+    if (sf) {
+        dsv_index_read(idx, sf, size);
+        fclose(sf);
+    }
+    /* an index cut short is not worth keeping */
+    if (idx->n == 0 && scan_index(f, idx)) {
+        sf = fopen(name, "w");
+        if (sf) {
+            if (!dsv_index_write(idx, sf, size)) {
+                DSV_WARNING(("failed to write index %s", name));
+            }
+            fclose(sf);
+        }
+    }
+    free(name);
+}
+
 static int
 decode(void)
 {
@@ -966,8 +1218,13 @@ decode(void)
     int code, first = 1;
     DSV_FNUM dec_frameno = 0;
     DSV_FNUM frameno = 0;
-    int to_420p, as_y4m, postsharp;
+    int to_420p, as_y4m, postsharp, wbuf_kb, lowres;
     FILE *inpfile, *outfile;
+    DSV_POOL *tmp_pool; /* conversion / post processing frames */
+    DSV_INDEX idx;
+    DSV_OFFSET resume = -1; /* where to continue after the seeked-to metadata */
+    unsigned sfr, lastfr = UINT_MAX;
+    int nfr;
 
     if (opts.inp[0] == USE_STDIO_CHAR) {
         inpfile = stdin;
@@ -988,16 +1245,46 @@ decode(void)
             return EXIT_FAILURE;
         }
     }
+    wbuf_kb = get_optval(dec_params, "wbuf");
+    /* stdout may have been written to already if verbose */
+    if (wbuf_kb > 0 && (outfile != stdout || !verbose)) {
+        setvbuf(outfile, NULL, _IOFBF, (size_t) wbuf_kb * 1024);
+    }
     memset(&dec, 0, sizeof(dec));
+    tmp_pool = dsv_pool_new(NULL);
     to_420p = get_optval(dec_params, "out420p");
     as_y4m = get_optval(dec_params, "y4m");
     postsharp = get_optval(dec_params, "postsharp");
     dec.draw_info = get_optval(dec_params, "drawinfo");
+    dec.fast = get_optval(dec_params, "fast");
+    dec.lowres = get_optval(dec_params, "scale");
+    lowres = (dec.fast == DSV_FAST_THUMB) ? DSV_MAX_LOWRES : dec.lowres;
+    sfr = get_optval(dec_params, "sfr");
+    nfr = get_optval(dec_params, "nfr");
+    if (nfr >= 0) {
+        lastfr = sfr + nfr;
+    }
+    dsv_index_init(&idx);
+    if (inpfile != stdin && (sfr > 0 || get_optval(dec_params, "sidx"))) {
+        int start;
+
+        load_index(inpfile, opts.inp, get_optval(dec_params, "sidx"), &idx);
+        start = dsv_index_seek(&idx, sfr);
+        if (start >= 0) {
+            DSV_INFO(("seeking to intra frame %d for frame %u", start, sfr));
+            /* decode the metadata in effect there, then the pictures */
+            dsv_file_seek(inpfile, idx.entries[start].meta);
+            resume = idx.entries[start].offset;
+            dec_frameno = start;
+        } else {
+            dsv_file_seek(inpfile, 0);
+        }
+    }
     if (verbose) {
         printf(DRV_HEADER);
         printf("\n");
     }
-    while (1) {
+    while (dec_frameno < lastfr) {
         int packet_type;
 
         if (read_packet(inpfile, &buffer, &packet_type) < 0) {
@@ -1007,6 +1294,10 @@ decode(void)
 
         code = dsv_dec(&dec, &buffer, &frame, &frameno);
 
+        if (code == DSV_DEC_GOT_META && resume >= 0) {
+            dsv_file_seek(inpfile, resume);
+            resume = -1;
+        }
         if (code == DSV_DEC_GOT_META) {
             static int got_it_once = 0;
             /* TODO: check if parameters changed mid-video? */
@@ -1014,12 +1305,19 @@ decode(void)
                 meta = dsv_get_metadata(&dec);
                 got_it_once = 1;
                 DSV_INFO(("got metadata"));
+                dsv_pipe_reserve(outfile, get_optval(dec_params, "outq"),
+                        DSV_ROUND_SHIFT(meta->width, lowres), DSV_ROUND_SHIFT(meta->height, lowres),
+                        to_420p ? DSV_SUBSAMP_420 : meta->subsamp);
             }
         } else {
             if (code == DSV_DEC_EOS) {
                 DSV_INFO(("got end of stream"));
                 break;
             }
+            if (code == DSV_DEC_SKIPPED) {
+                dec_frameno++;
+                continue;
+            }
             if (code != DSV_DEC_OK || (frame == NULL)) {
                 continue;
             }
@@ -1027,10 +1325,16 @@ decode(void)
                 DSV_ERROR(("no metadata!"));
                 break;
             }
+            if (dec_frameno < sfr) {
+                /* decoded on the way to the first requested frame */
+                dec_frameno++;
+                dsv_frame_ref_dec(frame);
+                continue;
+            }
             if (to_420p && meta->subsamp != DSV_SUBSAMP_420) {
-                DSV_FRAME *f420 = dsv_mk_frame(DSV_SUBSAMP_420, frame->width, frame->height, 0);
+                DSV_FRAME *f420 = dsv_pool_mk_frame(tmp_pool, DSV_SUBSAMP_420, frame->width, frame->height, 0);
                 if (meta->subsamp == DSV_SUBSAMP_444) {
-                    DSV_FRAME *f422 = dsv_mk_frame(DSV_SUBSAMP_422, frame->width, frame->height, 0);
+                    DSV_FRAME *f422 = dsv_pool_mk_frame(tmp_pool, DSV_SUBSAMP_422, frame->width, frame->height, 0);
                     conv444to422(&frame->planes[1], &f422->planes[1]);
                     conv444to422(&frame->planes[2], &f422->planes[2]);
                     conv422to420(&f422->planes[1], &f420->planes[1]);
@@ -1060,7 +1364,7 @@ decode(void)
                 }
                 if (as_y4m) {
                     if (first) {
-                        dsv_y4m_write_hdr(outfile, meta->width, meta->height,
+                        dsv_y4m_write_hdr(outfile, frame->width, frame->height,
                                DSV_SUBSAMP_420, meta->fps_num, meta->fps_den,
                                meta->aspect_num, meta->aspect_den);
                         first = 0;
@@ -1074,7 +1378,7 @@ decode(void)
             } else {
                 if (as_y4m) {
                     if (first) {
-                        dsv_y4m_write_hdr(outfile, meta->width, meta->height, meta->subsamp,
+                        dsv_y4m_write_hdr(outfile, frame->width, frame->height, meta->subsamp,
                                 meta->fps_num, meta->fps_den,
                                 meta->aspect_num, meta->aspect_den);
                         first = 0;
@@ -1082,7 +1386,8 @@ decode(void)
                     dsv_y4m_write_frame_hdr(outfile);
                 }
                 if (postsharp) {
-                    DSV_FRAME *tfr = dsv_clone_frame(frame, 0);
+                    DSV_FRAME *tfr = dsv_pool_mk_frame(tmp_pool, frame->format, frame->width, frame->height, 0);
+                    dsv_frame_copy(tfr, frame);
                     dsv_post_process(tfr->planes + 0);
                     if (dsv_yuv_write_seq(outfile, tfr->planes) < 0) {
                         DSV_ERROR(("failed to write frame (ID %u, actual %u)", frameno, dec_frameno));
@@ -1107,9 +1412,12 @@ decode(void)
     }
     DSV_INFO(("freeing decoder"));
     dsv_dec_free(&dec);
+    dsv_pool_release(tmp_pool);
+    dsv_index_free(&idx);
     if (meta) {
         dsv_free(meta);
     }
+    dsv_memory_report(&dec.mem);
     if (opts.inp[0] != USE_STDIO_CHAR) {
         fclose(inpfile);
     }
@@ -1119,6 +1427,128 @@ decode(void)
     return EXIT_SUCCESS;
 }
 
+/* append the packets of one chunk to the output, B.1 link offsets are
+ * rewritten so the joined stream can be walked in both directions */
+static int
+join_chunk(char *name, unsigned *prev_link, int *npkt)
+{
+    FILE *inpfile;
+    DSV_BUF buffer;
+    int packet_type, c, ok = 1;
+
+    if (name[0] == USE_STDIO_CHAR && name[1] == '\0') {
+        inpfile = stdin;
+    } else {
+        inpfile = fopen(name, "rb");
+        if (inpfile == NULL) {
+            printf("error opening input file %s\n", name);
+            return 0;
+        }
+    }
+    while (1) {
+        /* chunks encoded with -noeos=1 simply end */
+        c = getc(inpfile);
+        if (c == EOF) {
+            break;
+        }
+        ungetc(c, inpfile);
+
+        if (read_packet(inpfile, &buffer, &packet_type) < 0) {
+            DSV_ERROR(("error reading packet from %s", name));
+            ok = 0;
+            break;
+        }
+        if (packet_type == DSV_PT_EOS) {
+            dsv_buf_free(&buffer);
+            break;
+        }
+        if (packet_type == DSV_PT_TRAILER) {
+            /* its offsets are only valid for the chunk on its own */
+            dsv_buf_free(&buffer);
+            continue;
+        }
+        dsv_enc_set_links(buffer.data, *prev_link, buffer.len);
+        *prev_link = buffer.len;
+
+        ok = savebuffer(&buffer);
+        dsv_buf_free(&buffer);
+        if (!ok) {
+            break;
+        }
+        (*npkt)++;
+    }
+    if (inpfile != stdin) {
+        fclose(inpfile);
+    }
+    return ok;
+}
+
+static int
+join(int argc, char **argv)
+{
+    int i, nchunks = 0, npkt = 0, ok = 1;
+    unsigned prev_link = 0;
+    DSV_BUF eos;
+
+    /* options first, everything else is a chunk to be joined */
+    for (i = 1; i < argc; i++) {
+        char *a = argv[i];
+
+        if (strcmp("help", a) == 0 || strcmp("vhelp", a) == 0) {
+            usage_join();
+            return EXIT_SUCCESS;
+        }
+        if (a[0] == '-' && a[1] != '\0') {
+            if ((strcmp("-y", a) && strcmp("-v", a) &&
+                 strncmp("-l", a, 2) && strncmp("-out=", a, 5)) || !get_param(a)) {
+                printf("unrecognized argument: %s\n", a);
+                usage_join();
+                return EXIT_SUCCESS;
+            }
+            argv[i] = NULL;
+        } else {
+            nchunks++;
+        }
+    }
+    if (nchunks == 0) {
+        printf("no chunks to join!\n");
+        usage_join();
+        return EXIT_SUCCESS;
+    }
+    if (!promptoverwrite(opts.out)) {
+        return EXIT_FAILURE;
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+    _setmode(_fileno(stderr), _O_BINARY);
+#endif
+    if (!openoutput(opts.out, 0)) {
+        return EXIT_FAILURE;
+    }
+    for (i = 1; ok && i < argc; i++) {
+        if (argv[i] == NULL) {
+            continue;
+        }
+        ok = join_chunk(argv[i], &prev_link, &npkt);
+        if (ok && verbose) {
+            printf("joined %s, %d packets so far\n", argv[i], npkt);
+        }
+    }
+    if (ok && npkt > 0) {
+        dsv_enc_mk_eos(NULL, &eos, prev_link);
+        ok = savebuffer(&eos);
+        dsv_buf_free(&eos);
+    }
+    if (!closeoutput()) {
+        ok = 0;
+    }
+    if (verbose) {
+        printf("joined %d chunks, %d packets, %.0f bytes\n", nchunks, npkt, (double) bufsz);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static int
 startup(int argc, char **argv)
 {
@@ -1157,6 +1587,10 @@ split_paths(int argc, char **argv)
         encoding = 0;
         return startup(argc - 1, argv + 1);
     }
+    if (argv[1][0] == 'j') {
+        encoding = 0;
+        return join(argc - 1, argv + 1);
+    }
 badarg:
     usage_general();
     return EXIT_SUCCESS;
@@ -1174,7 +1608,5 @@ main(int argc, char **argv)
     opts.out = standard;
 
     ret = split_paths(argc, argv);
-
-    dsv_memory_report();
     return ret;
 }
@@ -17,22 +17,27 @@
 #include "dsv_internal.h"
 
 static DSV_FRAME *
-alloc_frame(void)
+alloc_frame(DSV_MEMORY *mem)
 {
     DSV_FRAME *frame;
 
-    frame = dsv_alloc(sizeof(*frame));
+    frame = dsv_alloc(mem, sizeof(*frame));
     frame->refcount = 1;
+    frame->mem = mem;
     return frame;
 }
 
-extern void
-dsv_mk_coefs(DSV_COEFS *c, int format, int width, int height)
+/* each coefficient plane starts on a DSV_ALIGN boundary (DSV_SBC is 4 bytes) */
+#define COEF_PLANE_LEN(c) \
+    DSV_ROUND_POW2((c).width * (c).height, DSV_ALIGN_SHIFT - 2)
+
+/* fills in the plane dimensions, returns the total number of coefs */
+static int
+coefs_layout(DSV_COEFS *c, int format, int width, int height)
 {
     int h_shift, v_shift;
     int chroma_width;
     int chroma_height;
-    int c0len, c1len, c2len;
 
     h_shift = DSV_FORMAT_H_SHIFT(format);
     v_shift = DSV_FORMAT_V_SHIFT(format);
@@ -43,30 +48,42 @@ dsv_mk_coefs(DSV_COEFS *c, int format, int width, int height)
     c[0].width = width;
     c[0].height = height;
 
-    c0len = c[0].width * c[0].height;
-
     c[1].width = chroma_width;
     c[1].height = chroma_height;
 
-    c1len = c[1].width * c[1].height;
-
     c[2].width = chroma_width;
     c[2].height = chroma_height;
 
-    c2len = c[2].width * c[2].height;
-    c[0].data = dsv_alloc((c0len + c1len + c2len) * sizeof(DSV_SBC));
-    c[1].data = c[0].data + c0len;
-    c[2].data = c[0].data + c0len + c1len;
+    return COEF_PLANE_LEN(c[0]) + COEF_PLANE_LEN(c[1]) + COEF_PLANE_LEN(c[2]);
+}
+
+static void
+coefs_assign(DSV_COEFS *c, DSV_SBC *data)
+{
+    c[0].data = data;
+    c[1].data = c[0].data + COEF_PLANE_LEN(c[0]);
+    c[2].data = c[1].data + COEF_PLANE_LEN(c[1]);
+}
+
+extern void
+dsv_mk_coefs(DSV_MEMORY *mem, DSV_COEFS *c, int format, int width, int height)
+{
+    int len;
+
+    len = coefs_layout(c, format, width, height);
+    coefs_assign(c, dsv_alloc_nozero(mem, len * sizeof(DSV_SBC)));
 }
 
 extern DSV_FRAME *
-dsv_mk_frame(int format, int width, int height, int border)
+dsv_mk_frame(DSV_MEMORY *mem, int format, int width, int height, int border)
 {
-    DSV_FRAME *f = alloc_frame();
+    DSV_FRAME *f = alloc_frame(mem);
     int h_shift, v_shift;
     int chroma_width;
     int chroma_height;
     int ext = 0;
+    int lead;
+    uint8_t *base;
 
     f->format = format;
     f->width = width;
@@ -85,37 +102,41 @@ dsv_mk_frame(int format, int width, int height, int border)
     f->planes[0].format = format;
     f->planes[0].w = width;
     f->planes[0].h = height;
-    f->planes[0].stride = DSV_ROUND_POW2((width + ext * 2), 4);
+    f->planes[0].stride = DSV_ROUND_POW2((width + ext * 2), DSV_ALIGN_SHIFT);
 
     f->planes[0].len = f->planes[0].stride * (f->planes[0].h + ext * 2);
 
     f->planes[1].format = format;
     f->planes[1].w = chroma_width;
     f->planes[1].h = chroma_height;
-    f->planes[1].stride = DSV_ROUND_POW2((chroma_width + ext * 2), 4);
+    f->planes[1].stride = DSV_ROUND_POW2((chroma_width + ext * 2), DSV_ALIGN_SHIFT);
 
     f->planes[1].len = f->planes[1].stride * (f->planes[1].h + ext * 2);
 
     f->planes[2].format = format;
     f->planes[2].w = chroma_width;
     f->planes[2].h = chroma_height;
-    f->planes[2].stride = DSV_ROUND_POW2((chroma_width + ext * 2), 4);
+    f->planes[2].stride = DSV_ROUND_POW2((chroma_width + ext * 2), DSV_ALIGN_SHIFT);
 
     f->planes[2].len = f->planes[2].stride * (f->planes[2].h + ext * 2);
 
-    f->alloc = dsv_alloc(f->planes[0].len + f->planes[1].len + f->planes[2].len);
+    /* strides and lengths are multiples of DSV_ALIGN, offsetting the planes
+     * by the remainder of the border puts every plane origin on the boundary */
+    lead = (DSV_ALIGN - (ext % DSV_ALIGN)) % DSV_ALIGN;
+    f->alloc = dsv_alloc(mem, lead + f->planes[0].len + f->planes[1].len + f->planes[2].len);
+    base = f->alloc + lead;
 
-    f->planes[0].data = f->alloc + f->planes[0].stride * ext + ext;
-    f->planes[1].data = f->alloc + f->planes[0].len + f->planes[1].stride * ext + ext;
-    f->planes[2].data = f->alloc + f->planes[0].len + f->planes[1].len + f->planes[2].stride * ext + ext;
+    f->planes[0].data = base + f->planes[0].stride * ext + ext;
+    f->planes[1].data = base + f->planes[0].len + f->planes[1].stride * ext + ext;
+    f->planes[2].data = base + f->planes[0].len + f->planes[1].len + f->planes[2].stride * ext + ext;
 
     return f;
 }
 
 extern DSV_FRAME *
-dsv_load_planar_frame(int format, void *data, int width, int height)
+dsv_load_planar_frame(DSV_MEMORY *mem, int format, void *data, int width, int height)
 {
-    DSV_FRAME *f = alloc_frame();
+    DSV_FRAME *f = alloc_frame(mem);
     int hs = 0, vs = 0;
     f->format = format;
     hs = DSV_FORMAT_H_SHIFT(format);
@@ -150,16 +171,227 @@ dsv_load_planar_frame(int format, void *data, int width, int height)
     return f;
 }
 
+extern DSV_FRAME *
+dsv_wrap_frame(DSV_MEMORY *mem, int format, uint8_t *planes[3], int strides[3], int width, int height, int border)
+{
+    DSV_FRAME *f = alloc_frame(mem);
+    int c, hs, vs;
+
+    f->format = format;
+    f->width = width;
+    f->height = height;
+    f->border = !!border;
+
+    hs = DSV_FORMAT_H_SHIFT(format);
+    vs = DSV_FORMAT_V_SHIFT(format);
+    for (c = 0; c < 3; c++) {
+        f->planes[c].format = format;
+        f->planes[c].w = c ? DSV_ROUND_SHIFT(width, hs) : width;
+        f->planes[c].h = c ? DSV_ROUND_SHIFT(height, vs) : height;
+        f->planes[c].stride = strides[c];
+        f->planes[c].len = strides[c] * f->planes[c].h;
+        f->planes[c].data = planes[c];
+    }
+    return f;
+}
+
 extern DSV_FRAME *
 dsv_clone_frame(DSV_FRAME *s, int border)
 {
     DSV_FRAME *d;
 
-    d = dsv_mk_frame(s->format, s->width, s->height, border);
+    d = dsv_mk_frame(s->mem, s->format, s->width, s->height, border);
     dsv_frame_copy(d, s);
     return d;
 }
 
+/* Frame / Coefficient Pools
+ *
+ * frames taken from a pool go back to it from dsv_frame_ref_dec once their
+ * last reference is gone. frames can outlive the codec that made them (the
+ * decoder hands its output to the caller), so the pool itself is only freed
+ * once its owner has released it and every frame has come back. releasing
+ * the pool detaches the frames still out from the codec's allocation
+ * context, which goes away with the codec.
+ */
+
+static void
+free_frame(DSV_FRAME *frame)
+{
+    if (frame->alloc) {
+        dsv_free(frame->alloc);
+    }
+    dsv_free(frame);
+}
+
+extern DSV_POOL *
+dsv_pool_new(DSV_MEMORY *mem)
+{
+    DSV_POOL *pool;
+
+    pool = dsv_alloc(mem, sizeof(DSV_POOL));
+    if (pool) {
+        pool->mem = mem;
+    }
+    return pool;
+}
+
+extern void
+dsv_pool_release(DSV_POOL *pool)
+{
+    DSV_FRAME *f;
+    int i;
+
+    if (pool == NULL) {
+        return;
+    }
+    for (i = 0; i < pool->nframes; i++) {
+        free_frame(pool->frames[i]);
+    }
+    pool->nframes = 0;
+    for (i = 0; i < pool->ncoefs; i++) {
+        dsv_free(pool->coefs[i]);
+    }
+    pool->ncoefs = 0;
+    pool->closed = 1;
+    if (pool->live == NULL) {
+        dsv_free(pool);
+        return;
+    }
+    for (f = pool->live; f; f = f->pool_next) {
+        dsv_alloc_detach(f->alloc);
+        dsv_alloc_detach(f);
+        f->mem = NULL;
+    }
+    dsv_alloc_detach(pool);
+    pool->mem = NULL;
+}
+
+static void
+pool_link(DSV_POOL *pool, DSV_FRAME *f)
+{
+    f->pool_prev = NULL;
+    f->pool_next = pool->live;
+    if (pool->live) {
+        pool->live->pool_prev = f;
+    }
+    pool->live = f;
+}
+
+static void
+pool_unlink(DSV_POOL *pool, DSV_FRAME *f)
+{
+    if (f->pool_prev) {
+        f->pool_prev->pool_next = f->pool_next;
+    } else {
+        pool->live = f->pool_next;
+    }
+    if (f->pool_next) {
+        f->pool_next->pool_prev = f->pool_prev;
+    }
+}
+
+extern DSV_FRAME *
+dsv_pool_mk_frame(DSV_POOL *pool, int format, int width, int height, int border)
+{
+    DSV_FRAME *f;
+    int i;
+
+    if (pool == NULL) {
+        return dsv_mk_frame(NULL, format, width, height, border);
+    }
+    border = !!border;
+    for (i = pool->nframes - 1; i >= 0; i--) {
+        f = pool->frames[i];
+        if (f->format == format && f->width == width &&
+            f->height == height && f->border == border) {
+            pool->nframes--;
+            memmove(pool->frames + i, pool->frames + i + 1, (pool->nframes - i) * sizeof(DSV_FRAME *));
+            f->refcount = 1;
+            pool_link(pool, f);
+            DSV_POOL_STAT(pool->mem, 1);
+            return f;
+        }
+    }
+    DSV_POOL_STAT(pool->mem, 0);
+    f = dsv_mk_frame(pool->mem, format, width, height, border);
+    f->pool = pool;
+    pool_link(pool, f);
+    return f;
+}
+
+static void
+pool_put_frame(DSV_FRAME *frame)
+{
+    DSV_POOL *pool = frame->pool;
+
+    pool_unlink(pool, frame);
+    if (pool->closed) {
+        free_frame(frame);
+        if (pool->live == NULL) {
+            dsv_free(pool);
+        }
+        return;
+    }
+    if (pool->nframes == DSV_POOL_SLOTS) {
+        /* evict the one that has been idle the longest */
+        free_frame(pool->frames[0]);
+        memmove(pool->frames, pool->frames + 1, (DSV_POOL_SLOTS - 1) * sizeof(DSV_FRAME *));
+        pool->nframes--;
+    }
+    pool->frames[pool->nframes++] = frame;
+}
+
+extern void
+dsv_pool_mk_coefs(DSV_POOL *pool, DSV_COEFS *c, int format, int width, int height)
+{
+    int i, len;
+
+    if (pool == NULL) {
+        dsv_mk_coefs(NULL, c, format, width, height);
+        return;
+    }
+    len = coefs_layout(c, format, width, height);
+    for (i = pool->ncoefs - 1; i >= 0; i--) {
+        if (pool->coefs_len[i] == len) {
+            coefs_assign(c, pool->coefs[i]);
+            pool->ncoefs--;
+            memmove(pool->coefs + i, pool->coefs + i + 1, (pool->ncoefs - i) * sizeof(DSV_SBC *));
+            memmove(pool->coefs_len + i, pool->coefs_len + i + 1, (pool->ncoefs - i) * sizeof(int));
+            DSV_POOL_STAT(pool->mem, 1);
+            return;
+        }
+    }
+    DSV_POOL_STAT(pool->mem, 0);
+    coefs_assign(c, dsv_alloc_nozero(pool->mem, len * sizeof(DSV_SBC)));
+}
+
+extern void
+dsv_pool_free_coefs(DSV_POOL *pool, DSV_COEFS *c)
+{
+    int len;
+
+    if (c[0].data == NULL) { /* only the first pointer is actual allocated data */
+        return;
+    }
+    if (pool == NULL) {
+        dsv_free(c[0].data);
+        c[0].data = NULL;
+        return;
+    }
+    len = COEF_PLANE_LEN(c[0]) + COEF_PLANE_LEN(c[1]) + COEF_PLANE_LEN(c[2]);
+    if (pool->ncoefs == DSV_POOL_SLOTS) {
+        dsv_free(pool->coefs[0]);
+        memmove(pool->coefs, pool->coefs + 1, (DSV_POOL_SLOTS - 1) * sizeof(DSV_SBC *));
+        memmove(pool->coefs_len, pool->coefs_len + 1, (DSV_POOL_SLOTS - 1) * sizeof(int));
+        pool->ncoefs--;
+    }
+    pool->coefs[pool->ncoefs] = c[0].data;
+    pool->coefs_len[pool->ncoefs] = len;
+    pool->ncoefs++;
+    c[0].data = NULL;
+}
+
 extern DSV_FRAME *
 dsv_frame_ref_inc(DSV_FRAME *frame)
 {
@@ -175,10 +407,14 @@ dsv_frame_ref_dec(DSV_FRAME *frame)
 
     frame->refcount--;
     if (frame->refcount == 0) {
-        if (frame->alloc) {
-            dsv_free(frame->alloc);
+        if (frame->release) {
+            frame->release(frame->release_user, frame);
+        }
+        if (frame->pool) {
+            pool_put_frame(frame);
+        } else {
+            free_frame(frame);
         }
-        dsv_free(frame);
     }
 }
 
@@ -366,18 +602,20 @@ extend_plane(DSV_FRAME *frame, int p)
     uint8_t *ls, *rs, *ts, *bs; /* left, right, top, bottom strips */
     int tl, tr, bl, br; /* top left, top right, bottom left, bottom right */
 
-    ls = dsv_alloc(4 * height / SUBDIV);
-    rs = dsv_alloc(4 * height / SUBDIV);
-    ts = dsv_alloc(4 * width / SUBDIV);
-    bs = dsv_alloc(4 * width / SUBDIV);
+    /* one allocation for all four strips */
+    ls = dsv_alloc(frame->mem, 2 * (4 * height / SUBDIV) + 2 * (4 * width / SUBDIV));
+    rs = ls + (4 * height / SUBDIV);
+    ts = rs + (4 * height / SUBDIV);
+    bs = ts + (4 * width / SUBDIV);
     downsample_strip(frame, p, 0, ls);
     downsample_strip(frame, p, 1, rs);
     downsample_strip(frame, p, 2, ts);
     downsample_strip(frame, p, 3, bs);
+    /* planes of reduced resolution decodes can be narrower than SUBDIV */
     tl = (ts[0] + ls[0] + 1) >> 1;
-    tr = (ts[(width / SUBDIV) - 1] + rs[0] + 1) >> 1;
-    bl = (ls[(height / SUBDIV) - 1] + bs[0] + 1) >> 1;
-    br = (bs[(width / SUBDIV) - 1] + rs[(height / SUBDIV) - 1] + 1) >> 1;
+    tr = (ts[MAX(width / SUBDIV, 1) - 1] + rs[0] + 1) >> 1;
+    bl = (ls[MAX(height / SUBDIV, 1) - 1] + bs[0] + 1) >> 1;
+    br = (bs[MAX(width / SUBDIV, 1) - 1] + rs[MAX(height / SUBDIV, 1) - 1] + 1) >> 1;
 
     for (j = 0; j < height; j++) {
         line = DSV_GET_LINE(c, j);
@@ -404,9 +642,6 @@ extend_plane(DSV_FRAME *frame, int p)
     }
 
     dsv_free(ls);
-    dsv_free(rs);
-    dsv_free(ts);
-    dsv_free(bs);
 }
 
 extern DSV_FRAME *
@@ -15,6 +15,7 @@
 /*****************************************************************************/
 
 #include "dsv_encoder.h"
+#include "dsv_internal.h"
 
 /* Hierarchical Motion Estimation */
 
@@ -123,39 +124,50 @@ iisqrt(unsigned n)
     return res;
 }
 
-#define METR_CALC(acc) {                                                    \
+/* the three error terms are summed separately and weighted once per block,
+ * (x << k) distributes over the unsigned sum so the result is unchanged.
+ * keeping the loop body free of shifts by loop-invariant amounts lets
+ * compilers vectorize it. */
+#define METR_CALC(acc_e, acc_t, acc_s) {                                    \
         int ta, tb, se;/* texture in block A, ~ block B, squared error */   \
         se = UAVG4(abs(a1 - b1), abs(a2 - b2), abs(a3 - b3), abs(a4 - b4)); \
         ta = UAVG4(abs(a1 - a2), abs(a2 - a3), abs(a3 - a4), abs(a4 - a1)); \
         tb = UAVG4(abs(b1 - b2), abs(b2 - b3), abs(b3 - b4), abs(b4 - b1)); \
-        (acc) += SQR(se) << psy->err_weight;                                \
-        (acc) += SQR(ta - tb) << psy->tex_weight;                           \
-        (acc) += SQR(s0 - s1) << psy->avg_weight;                           \
+        (acc_e) += SQR(se);                                                 \
+        (acc_t) += SQR(ta - tb);                                            \
+        (acc_s) += SQR(s0 - s1);                                            \
 }
 
+#define METR_WEIGHT(acc_e, acc_t, acc_s)      \
+        (((acc_e) << psy->err_weight) +       \
+         ((acc_t) << psy->tex_weight) +       \
+         ((acc_s) << psy->avg_weight))
+
 #define METR_BODY(w, h)                                        \
         int i, j;                                              \
-        unsigned acc = 0;                                      \
+        unsigned acc;                                          \
+        unsigned acc_e = 0, acc_t = 0, acc_s = 0;              \
         for (j = 0; j < h / 2; j++) {                          \
-            int bp = 0;                                        \
+            uint8_t *a0 = a + as;                              \
+            uint8_t *b0 = b + bs;                              \
             for (i = 0; i < w / 2; i++) {                      \
                 int a1, a2, a3, a4, b1, b2, b3, b4, s0, s1;    \
-                a1 = a[bp];                                    \
-                a2 = a[bp + 1];                                \
-                a3 = a[bp + as];                               \
-                a4 = a[bp + 1 + as];                           \
+                a1 = a[2 * i];                                 \
+                a2 = a[2 * i + 1];                             \
+                a3 = a0[2 * i];                                \
+                a4 = a0[2 * i + 1];                            \
                 s0 = UAVG4(a1, a2, a3, a4);                    \
-                b1 = b[bp];                                    \
-                b2 = b[bp + 1];                                \
-                b3 = b[bp + bs];                               \
-                b4 = b[bp + 1 + bs];                           \
+                b1 = b[2 * i];                                 \
+                b2 = b[2 * i + 1];                             \
+                b3 = b0[2 * i];                                \
+                b4 = b0[2 * i + 1];                            \
                 s1 = UAVG4(b1, b2, b3, b4);                    \
-                bp += 2;                                       \
-                METR_CALC(acc);                                \
+                METR_CALC(acc_e, acc_t, acc_s);                \
             }                                                  \
             a += 2 * as;                                       \
             b += 2 * bs;                                       \
         }                                                      \
+        acc = METR_WEIGHT(acc_e, acc_t, acc_s);                \
 
 #define MAKE_METR(w)                                           \
 static unsigned                                                \
@@ -245,7 +257,7 @@ static unsigned
 qpsad(uint8_t *a, int as, uint8_t *b, PSY_COEFS *psy)
 {
     int i, j;
-    unsigned acc = 0;
+    unsigned acc_e = 0, acc_t = 0, acc_s = 0;
     for (j = 0; j < SP_SAD_SZ / 2; j++) {
         int ap = 0;
         for (i = 0; i < SP_SAD_SZ / 2; i++) {
@@ -261,11 +273,11 @@ qpsad(uint8_t *a, int as, uint8_t *b, PSY_COEFS *psy)
             b4 = b[QP_OFFSET(i * 2 + 1, j * 2 + 1)];
             s1 = UAVG4(b1, b2, b3, b4);
             ap += 2;
-            METR_CALC(acc);
+            METR_CALC(acc_e, acc_t, acc_s);
         }
         a += 2 * as;
     }
-    return METRIC_RETURN(acc, SP_SAD_SZ, SP_SAD_SZ);
+    return METRIC_RETURN(METR_WEIGHT(acc_e, acc_t, acc_s), SP_SAD_SZ, SP_SAD_SZ);
 }
 
 static unsigned
@@ -351,13 +363,14 @@ hier_metr(int level, uint8_t *a, int as, uint8_t *b, int bs, int w, int h, PSY_C
     return fastmetr(a, as, b, bs, w, h, psy);
 }
 
+/* uses the predictor cached for the current block in hme->pred_x/y */
 static int
-mv_cost(DSV_MV *vecs, DSV_PARAMS *p, int i, int j, int mx, int my, int q, int level)
+mv_cost(DSV_HME *hme, int mx, int my, int level)
 {
-    int sqr, cost;
+    int sqr, cost, q = hme->quant;
 
     sqr = SQUARED_LEVELS;
-    cost = dsv_mv_cost(vecs, p, i, j, mx, my, q, sqr);
+    cost = dsv_mv_cost_pred(hme->params, hme->pred_x, hme->pred_y, mx, my, q, sqr);
     cost = MIN(cost, 1 << 19);
     if (sqr) {
         return cost * (q * q >> DSV_MAX_QP_BITS) >> (DSV_MAX_QP_BITS - 2);
@@ -787,7 +800,7 @@ hpfv(uint8_t *p, int s)
 static void
 hpel(uint8_t *dec, uint8_t *ref, int rs)
 {
-    static int16_t buf[(DSV_MAX_BLOCK_SIZE + 3) * DSV_MAX_BLOCK_SIZE];
+    int16_t buf[(DSV_MAX_BLOCK_SIZE + 3) * DSV_MAX_BLOCK_SIZE];
     uint8_t *drow;
     int i, j, c, x;
 
@@ -1050,17 +1063,16 @@ next:
 
 static unsigned
 subpixel_ME(
-        DSV_PARAMS *params,
-        DSV_MV *mvf, /* motion vector field */
+        DSV_HME *hme,
         DSV_MV *mv, /* OUTPUT: will return just the subpel components */
         int fpelx, int fpely,
         DSV_FRAME *src, DSV_FRAME *ref,
-        int i, int j,
-        unsigned best, int quant,
+        unsigned best,
         int bx, int by, int bw, int bh, PSY_COEFS *psy)
 {
-    static uint8_t tmph[(2 + HP_STRIDE) * (2 + HP_STRIDE)];
-    static uint8_t tmpq[(4 + QP_STRIDE) * (4 + QP_STRIDE)];
+    DSV_PARAMS *params = hme->params;
+    uint8_t tmph[(2 + HP_STRIDE) * (2 + HP_STRIDE)];
+    uint8_t tmpq[(4 + QP_STRIDE) * (4 + QP_STRIDE)];
     static int dx[4] = { 1, -1, 0,  0 };
     static int dy[4] = { 0,  0, 1, -1 };
     DSV_PLANE srcp, refp, srcsp, refsp;
@@ -1151,7 +1163,7 @@ subpixel_ME(
 
         evx = MK_MV_COMP(fpelx, 0, t[0]);
         evy = MK_MV_COMP(fpely, 0, t[1]);
-        score += mv_cost(mvf, params, i, j, evx, evy, quant, 0);
+        score += mv_cost(hme, evx, evy, 0);
 
         if (best > score) {
             best = score;
@@ -1208,11 +1220,9 @@ add_spatial_predictions(int level, int i, int j, int n, DSV_MV **list,
     step = 1 << level;
     if (level == 0) {
         DSV_MV tmv;
-        int px, py;
 
-        dsv_movec_pred(mvf, p, i, j, &px, &py);
-        tmv.u.mv.x = px;
-        tmv.u.mv.y = py;
+        tmv.u.mv.x = hme->pred_x;
+        tmv.u.mv.y = hme->pred_y;
         n = add_mv_to_list(hme, list, n, &tmv);
     }
     if (i > 0) { /* left */
@@ -1298,7 +1308,7 @@ find_inliers(DSV_MV **list, DSV_MV **newl, int n, int *ax, int *ay)
 }
 
 static int
-refine_best_fpel_cand(DSV_HME *hme, int level, int i, int j,
+refine_best_fpel_cand(DSV_HME *hme, int level,
        /* both input and output: */ int *bestx, int *besty, unsigned *best,
         unsigned good_enough_thresh,
         DSV_PLANE *src_block,
@@ -1336,9 +1346,9 @@ retry:
             *best = score;
             return 1;
         }
-        score += mv_cost(hme->mvf[level], hme->params, i, j,
+        score += mv_cost(hme,
                 MK_MV_COMP(tvx * step, 0, 0),
-                MK_MV_COMP(tvy * step, 0, 0), hme->quant, level);
+                MK_MV_COMP(tvy * step, 0, 0), level);
         if (*best > score) {
             *best = score;
             *bestx = tvx;
@@ -1357,9 +1367,9 @@ retry:
     score = hier_metr(level, src_block->data, src_block->stride,
             DSV_GET_XY(rp, bx + tvx, by + tvy), rp->stride, bw, bh, psy);
 
-    score += mv_cost(hme->mvf[level], hme->params, i, j,
+    score += mv_cost(hme,
             MK_MV_COMP(tvx * step, 0, 0),
-            MK_MV_COMP(tvy * step, 0, 0), hme->quant, level);
+            MK_MV_COMP(tvy * step, 0, 0), level);
     if (*best > score) {
         *best = score;
         *bestx = tvx;
@@ -1396,7 +1406,7 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
     sp = src->planes + 0;
     rp = ref->planes + 0;
 
-    hme->mvf[level] = dsv_alloc(sizeof(DSV_MV) * nxb * nyb);
+    hme->mvf[level] = dsv_alloc(params->mem, sizeof(DSV_MV) * nxb * nyb);
 
     mvf = hme->mvf[level];
 
@@ -1435,8 +1445,12 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
                 mvf[i + j * nxb] = zmv;
                 continue;
             }
-            memset(&hme->mv_bank, 0, sizeof(hme->mv_bank));
+            /* candidates only ever use the vector part of the bank
+             * entries and add_mv_to_list writes all of it */
             hme->n_mv_bank_used = 0;
+            /* the predictor only depends on already decided neighbors,
+             * so it stays the same for every vector tested in this block */
+            dsv_movec_pred(mvf, params, i, j, &hme->pred_x, &hme->pred_y);
             dsv_plane_xy(src, &srcp, 0, bx, by);
             bw = MIN(srcp.w, y_w);
             bh = MIN(srcp.h, y_h);
@@ -1455,9 +1469,6 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
                     uint16_t hist[NHIST];
                     uint8_t peaks[NHIST];
 
-                    /* TODO this logic could use much more testing */
-                    var_src = block_detail(srcp.data, srcp.stride, bw, bh, &avg_src);
-
                     hvar = block_hist_var(srcp.data, srcp.stride, bw, bh, hist);
                     qtex = quant_tex(srcp.data, srcp.stride, bw, bh);
                     npeaks = block_peaks(srcp.data, srcp.stride, bw, bh, peaks, hist, avg_src);
@@ -1544,9 +1555,9 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
                 if (dx == 0 && dy == 0) {
                     score_zero = score;
                 }
-                score += mv_cost(mvf, params, i, j,
+                score += mv_cost(hme,
                         MK_MV_COMP(dx * step, 0, 0),
-                        MK_MV_COMP(dy * step, 0, 0), hme->quant, level);
+                        MK_MV_COMP(dy * step, 0, 0), level);
                 if (dx == lax && dy == lay) {
                     score = MAX((int) score - (motion_bias >> level), 0);
                 }
@@ -1586,7 +1597,7 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
             if (!good_enough) {
                 /* try to improve upon the best candidate vector by
                  * searching in a rectangular fashion around it */
-                good_enough = refine_best_fpel_cand(hme, level, i, j,
+                good_enough = refine_best_fpel_cand(hme, level,
                         &dx, &dy, &best, qthresh,
                         &srcp,
                         bx, by, bw, bh, &psy);
@@ -1611,9 +1622,8 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
                 if (params->effort >= 4) {
                     /* first search local average from parents */
                     if (!invalid_block(ref, bx + lax, by + lay, bw, bh, 4)) {
-                        best = subpixel_ME(params, mvf, mv, lax, lay, src, ref, i, j,
-                                best_fp,
-                                hme->quant, bx, by, bw, bh, &psy);
+                        best = subpixel_ME(hme, mv, lax, lay, src, ref,
+                                best_fp, bx, by, bw, bh, &psy);
                         if (mv->u.all) { /* found a subpel */
                             fpelx = lax;
                             fpely = lay;
@@ -1622,7 +1632,7 @@ refine_level(DSV_HME *hme, int level, int *scene_change_blocks, int *avg_err, in
 
                     if (!mv->u.all && !good_enough && !invalid_block(ref, bx + fpelx, by + fpely, bw, bh, 4)) {
                         /* if nothing so far, search final MV from HME */
-                        best = subpixel_ME(params, mvf, mv, fpelx, fpely, src, ref, i, j, best_fp, hme->quant, bx, by, bw, bh, &psy);
+                        best = subpixel_ME(hme, mv, fpelx, fpely, src, ref, best_fp, bx, by, bw, bh, &psy);
                     }
                 }
 
@@ -1846,7 +1856,7 @@ dsv_intra_analysis(DSV_FRAME *src, DSV_PARAMS *params)
     nxb = params->nblocks_h;
     nyb = params->nblocks_v;
 
-    ba = dsv_alloc(nxb * nyb * sizeof(DSV_MV));
+    ba = dsv_alloc(params->mem, nxb * nyb * sizeof(DSV_MV));
 
     scale = 2 * dsv_spatial_psy_factor(params, -1);
     for (j = 0; j < nyb; j++) {
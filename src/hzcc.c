@@ -227,16 +227,70 @@ dequantD(int v, unsigned q)
     return (v * q) + ((v < 0) ? -(q / 2) : (q / 2));
 }
 
+/* quantizer for every combination of block flags and parent significance,
+ * index is (flags << 1) | (parent != 0) */
+#define QMAP_SIZE (256 * 2)
+
+static void
+fill_qmap(int *qmap, int qp, int isP, int l)
+{
+    int flags, parc, tmq;
+
+    for (flags = 0; flags < 256; flags++) {
+        for (parc = 0; parc < 2; parc++) {
+            tmq = qp;
+            if (isP) {
+                TMQ4POS_P(tmq, flags);
+            } else {
+                TMQ4POS_I(tmq, flags, l);
+            }
+            qmap[(flags << 1) | parc] = tmq;
+        }
+    }
+}
+
+/* smallest magnitude that can quantize to something other than zero with
+ * quantizer 'q', for every quantSUB rounding offset the encoder uses */
+#define SIG_THRESH(q) ((q) * 2 / 3)
+
+/* one bit per coefficient of 'row' (at most 32) that reaches 't',
+ * the ones below are cleared */
+static uint32_t
+sig_word(DSV_SBC *row, int n, int t)
+{
+    uint32_t word = 0;
+    int i, nz;
+
+    for (i = 0; i < n; i++) {
+        nz = (row[i] >= t) | (row[i] <= -t);
+        word |= (uint32_t) nz << i;
+        row[i] = nz ? row[i] : 0;
+    }
+    return word;
+}
+
+/* index of the lowest set bit, de Bruijn multiply and lookup */
+static const uint8_t ctz_tab[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+};
+
+#define CTZ(w) (ctz_tab[((uint32_t) (((w) & -(w)) * 0x077cb531U)) >> 27])
+
 #define DAMP (3 + l)
 #define PUTV(bs, v)  (dsv_bs_put_nrice(bs, v, &vk, DAMP))
 #define GETV(bs)     (dsv_bs_get_nrice(bs, &vk, DAMP))
 
+/* each subband row is first reduced to significance bitmaps 32 coefficients
+ * at a time, only the coefficients with their bit set are quantized and
+ * coded. 'run' counts the zeros since the last coded coefficient, 'px' is
+ * the first position of the row not yet counted. */
 static void
 hzcc_enc(DSV_BS *bs, DSV_SBC *src, int w, int h, int q, DSV_FMETA *fm)
 {
     int x, y, l, s, o, v;
     int sw, sh;
-    int bx, by;
+    int cx, px, t;
     int dbx, dby;
     int qp;
     int run = 0;
@@ -245,6 +299,8 @@ hzcc_enc(DSV_BS *bs, DSV_SBC *src, int w, int h, int q, DSV_FMETA *fm)
     int startp, endp;
     int isP;
     int vk = 0;
+    uint32_t word;
+    int qmap[QMAP_SIZE];
 
     dsv_bs_align(bs);
     startp = dsv_bs_ptr(bs);
@@ -267,16 +323,20 @@ hzcc_enc(DSV_BS *bs, DSV_SBC *src, int w, int h, int q, DSV_FMETA *fm)
 
     if (fm->params->lossless) {
         for (y = 0; y < sh; y++) {
-            for (x = 0; x < sw; x++) {
-                v = srcp[x];
-                if (v) {
-                    dsv_bs_put_ueg(bs, run);
-                    dsv_bs_put_neg(bs, v);
-                    run = -1;
+            px = 0;
+            for (cx = 0; cx < sw; cx += 32) {
+                word = sig_word(srcp + cx, MIN(sw - cx, 32), 1);
+                while (word) {
+                    x = cx + CTZ(word);
+                    word &= word - 1;
+                    dsv_bs_put_ueg(bs, run + x - px);
+                    dsv_bs_put_neg(bs, srcp[x]);
+                    run = 0;
+                    px = x + 1;
                     nruns++;
                 }
-                run++;
             }
+            run += sw - px;
             srcp += w;
         }
         for (l = 0; l < MAXLVL; l++) {
@@ -288,42 +348,52 @@ hzcc_enc(DSV_BS *bs, DSV_SBC *src, int w, int h, int q, DSV_FMETA *fm)
 
                 srcp = src + o;
                 for (y = 0; y < sh; y++) {
-                    for (x = 0; x < sw; x++) {
-                        v = srcp[x];
-                        if (v) {
-                            dsv_bs_put_ueg(bs, run);
-                            PUTV(bs, v);
-                            run = -1;
+                    px = 0;
+                    for (cx = 0; cx < sw; cx += 32) {
+                        word = sig_word(srcp + cx, MIN(sw - cx, 32), 1);
+                        while (word) {
+                            x = cx + CTZ(word);
+                            word &= word - 1;
+                            dsv_bs_put_ueg(bs, run + x - px);
+                            PUTV(bs, srcp[x]);
+                            run = 0;
+                            px = x + 1;
                             nruns++;
-                        } else {
-                            srcp[x] = 0;
                         }
-                        run++;
                     }
+                    run += sw - px;
                     srcp += w;
                 }
             }
         }
     } else {
         /* C.2.3 LL Subband */
+        t = SIG_THRESH(qp);
         for (y = 0; y < sh; y++) {
-            for (x = 0; x < sw; x++) {
-                if (!fm->isP) {
-                    v = quantSUB(srcp[x], qp, -(qp / 6));
-                } else {
-                    v = quantS(srcp[x], qp);
-                }
-                if (v) {
-                    srcp[x] = dequantL(v, qp);
-                    dsv_bs_put_ueg(bs, run);
-                    dsv_bs_put_neg(bs, v);
-                    run = -1;
-                    nruns++;
-                } else {
-                    srcp[x] = 0;
+            px = 0;
+            for (cx = 0; cx < sw; cx += 32) {
+                word = sig_word(srcp + cx, MIN(sw - cx, 32), t);
+                while (word) {
+                    x = cx + CTZ(word);
+                    word &= word - 1;
+                    if (!fm->isP) {
+                        v = quantSUB(srcp[x], qp, -(qp / 6));
+                    } else {
+                        v = quantS(srcp[x], qp);
+                    }
+                    if (v) {
+                        srcp[x] = dequantL(v, qp);
+                        dsv_bs_put_ueg(bs, run + x - px);
+                        dsv_bs_put_neg(bs, v);
+                        run = 0;
+                        px = x + 1;
+                        nruns++;
+                    } else {
+                        srcp[x] = 0;
+                    }
                 }
-                run++;
             }
+            run += sw - px;
             srcp += w;
         }
         for (l = 0; l < MAXLVL; l++) {
@@ -335,105 +405,116 @@ hzcc_enc(DSV_BS *bs, DSV_SBC *src, int w, int h, int q, DSV_FMETA *fm)
             sh = dimat(l, h);
             dbx = (fm->params->nblocks_h << DSV_BLOCK_INTERP_P) / sw;
             dby = (fm->params->nblocks_v << DSV_BLOCK_INTERP_P) / sh;
-            qp = q;
             psyI = (fm->params->do_psy & DSV_PSY_I_VISUAL_MASKING) && !fm->cur_plane;
             psyP = (fm->params->do_psy & DSV_PSY_P_VISUAL_MASKING) && !fm->cur_plane;
             /* C.2.4 Higher Level Subbands */
             for (s = 1; s < NSUBBAND; s++) {
-                int gpar, par;
+                int gpar, par, i;
                 DSV_SBC *gparent, *parent;
                 gpar = subband(l - 2, s, w, h);
                 par = subband(l - 1, s, w, h);
                 o = subband(l, s, w, h);
                 qp = hfquant(fm, q, s, l);
+                fill_qmap(qmap, qp, isP, l);
+                t = qmap[0];
+                for (i = 1; i < QMAP_SIZE; i++) {
+                    t = MIN(t, qmap[i]);
+                }
+                t = SIG_THRESH(t);
 
                 srcp = src + o;
-                by = 0;
                 for (y = 0; y < sh; y++) {
-                    bx = 0;
-                    blockrow = fm->blockdata + (by >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
-                    mvrow = fm->mvs + (by >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
+                    int bi = ((y * dby) >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
+                    blockrow = fm->blockdata + bi;
+                    mvrow = fm->mvs + bi;
                     gparent = src + gpar + (((y >> 2)) * w);
                     parent = src + par + ((y >> 1) * w);
-                    for (x = 0; x < sw; x++) {
-                        int tmq = qp;
-                        int flags = blockrow[bx >> DSV_BLOCK_INTERP_P];
-                        DSV_MV *mv = &mvrow[bx >> DSV_BLOCK_INTERP_P];
-                        int gparc = gparent[x >> 2];
-                        int parc = parent[x >> 1];
-
-                        int texture = !parc; /* texture has no parent, edge has parent */
-                        int gtexture = !gparc; /* texture has no parent, edge has parent */
-                        if (isP) {
-                            TMQ4POS_P(tmq, flags);
+                    px = 0;
+                    for (cx = 0; cx < sw; cx += 32) {
+                        word = sig_word(srcp + cx, MIN(sw - cx, 32), t);
+                        while (word) {
+                            int tmq, flags, gparc, parc, texture, gtexture;
+                            DSV_MV *mv;
+
+                            x = cx + CTZ(word);
+                            word &= word - 1;
+                            /* block position is (x * nblocks) / sw in fixed point */
+                            flags = blockrow[(x * dbx) >> DSV_BLOCK_INTERP_P];
+                            mv = &mvrow[(x * dbx) >> DSV_BLOCK_INTERP_P];
+                            gparc = gparent[x >> 2];
+                            parc = parent[x >> 1];
+                            tmq = qmap[(flags << 1) | (parc != 0)];
+
+                            texture = !parc; /* texture has no parent, edge has parent */
+                            gtexture = !gparc; /* texture has no parent, edge has parent */
+                            if (isP) {
 #define MV_LT(v, t) (abs((v)->u.mv.x) < (t) && abs((v)->u.mv.y) < (t)) /* less than */
 
-                            if (psyP) {
-                                if ((gtexture && texture) || DSV_MV_IS_EPRM(mv) || (DSV_MV_IS_MAINTAIN(mv) && MV_LT(mv, 32))) {
-                                    v = quantSUB(srcp[x], tmq, tmq >> 3);
-                                } else {
-                                    if (texture || !(flags & DSV_IS_SIMCMPLX)) {
-                                        v = quantSUB(srcp[x], tmq, tmq / 6);
+                                if (psyP) {
+                                    if ((gtexture && texture) || DSV_MV_IS_EPRM(mv) || (DSV_MV_IS_MAINTAIN(mv) && MV_LT(mv, 32))) {
+                                        v = quantSUB(srcp[x], tmq, tmq >> 3);
                                     } else {
-                                        v = quantSUB(srcp[x], tmq, tmq >> 2);
+                                        if (texture || !(flags & DSV_IS_SIMCMPLX)) {
+                                            v = quantSUB(srcp[x], tmq, tmq / 6);
+                                        } else {
+                                            v = quantSUB(srcp[x], tmq, tmq >> 2);
+                                        }
                                     }
+                                } else {
+                                    v = quantS(srcp[x], tmq);
                                 }
                             } else {
-                                v = quantS(srcp[x], tmq);
-                            }
-                        } else {
-                            TMQ4POS_I(tmq, flags, l);
-                            /* psychovisual: visual masking */
-                            if (psyI) {
+                                /* psychovisual: visual masking */
+                                if (psyI) {
 #define sign(x) ((x) < 0 ? -1 : (x) > 0 ? 1 : 0)
-                                int edge, stp, smf;
+                                    int edge, stp, smf;
 
-                                smf = flags & (DSV_IS_MAINTAIN | DSV_IS_STABLE);
+                                    smf = flags & (DSV_IS_MAINTAIN | DSV_IS_STABLE);
 
-                                if (flags & DSV_IS_RINGING) {
-                                    v = quantSUB(srcp[x], tmq, -(tmq / 6));
+                                    if (flags & DSV_IS_RINGING) {
+                                        v = quantSUB(srcp[x], tmq, -(tmq / 6));
+                                    } else {
+                                        switch (l) {
+                                            case LVL3:
+                                                v = quantSUB(srcp[x], tmq, -(tmq >> 3));
+                                                break;
+                                            default:
+                                            case LVL1:
+                                            case LVL2:
+                                                edge = sign(parc) == sign(srcp[x]);
+                                                if (smf == 0) {
+                                                    stp = -tmq / 3;
+                                                } else if (edge && (smf == DSV_IS_STABLE)) {
+                                                    stp = tmq >> 3;
+                                                } else {
+                                                    stp = -tmq / 6;
+                                                }
+                                                v = quantSUB(srcp[x], tmq, stp);
+                                                break;
+                                        }
+                                    }
                                 } else {
-                                    switch (l) {
-                                        case LVL3:
-                                            v = quantSUB(srcp[x], tmq, -(tmq >> 3));
-                                            break;
-                                        default:
-                                        case LVL1:
-                                        case LVL2:
-                                            edge = sign(parc) == sign(srcp[x]);
-                                            if (smf == 0) {
-                                                stp = -tmq / 3;
-                                            } else if (edge && (smf == DSV_IS_STABLE)) {
-                                                stp = tmq >> 3;
-                                            } else {
-                                                stp = -tmq / 6;
-                                            }
-                                            v = quantSUB(srcp[x], tmq, stp);
-                                            break;
+                                    if (fm->cur_plane) {
+                                        v = quantSUB(srcp[x], tmq, -(tmq >> 3));
+                                    } else {
+                                        v = quantS(srcp[x], tmq);
                                     }
                                 }
+                            }
+                            if (v) {
+                                srcp[x] = dequantH(v, tmq);
+                                dsv_bs_put_ueg(bs, run + x - px);
+                                PUTV(bs, v);
+                                run = 0;
+                                px = x + 1;
+                                nruns++;
                             } else {
-                                if (fm->cur_plane) {
-                                    v = quantSUB(srcp[x], tmq, -(tmq >> 3));
-                                } else {
-                                    v = quantS(srcp[x], tmq);
-                                }
+                                srcp[x] = 0;
                             }
                         }
-                        if (v) {
-                            srcp[x] = dequantH(v, tmq);
-                            dsv_bs_put_ueg(bs, run);
-                            PUTV(bs, v);
-                            run = -1;
-                            nruns++;
-                        } else {
-                            srcp[x] = 0;
-                        }
-                        run++;
-                        bx += dbx;
                     }
+                    run += sw - px;
                     srcp += w;
-                    by += dby;
                 }
             }
         }
@@ -447,21 +528,27 @@ hzcc_enc(DSV_BS *bs, DSV_SBC *src, int w, int h, int q, DSV_FMETA *fm)
     dsv_bs_align(bs);
 }
 
+#define NEXT_RUN() ((runs-- > 0) ? dsv_bs_get_ueg(bs) : UINT_MAX)
+
+/* rows are walked run by run, only the coefficients that were coded are
+ * visited. 'run' carries the zeros left over into the next row. */
 static void
 hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_FMETA *fm)
 {
     int x, y, l, s, o, v;
     int qp;
     int sw, sh;
-    int bx, by;
     int dbx, dby;
-    int run, runs;
+    int runs;
+    unsigned run;
     DSV_SBC *out = dst->data;
     DSV_SBC *outp;
     int w = dst->width;
     int h = dst->height;
     int isP;
     int vk = 0;
+    int nlvl = MAXLVL - fm->lowres; /* levels beyond are not reconstructed */
+    int qmap[QMAP_SIZE];
 
     dsv_bs_align(bs);
     runs = dsv_bs_get_bits(bs, RUN_BITS);
@@ -478,24 +565,25 @@ hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_FMETA *fm)
     o = subband(l, s, w, h);
     outp = out + o;
 
-    run = (runs-- > 0) ? dsv_bs_get_ueg(bs) : INT_MAX;
+    run = NEXT_RUN();
 
     if (fm->params->lossless) {
         /* C.2.3 LL Subband */
         for (y = 0; y < sh; y++) {
-            for (x = 0; x < sw; x++) {
-                if (!run--) {
-                    v = dsv_bs_get_neg(bs);
-                    run = (runs-- > 0) ? dsv_bs_get_ueg(bs) : INT_MAX;
-                    if (dsv_bs_ptr(bs) >= bufsz) {
-                        return;
-                    }
-                    outp[x] = v;
+            x = 0;
+            while (run < (unsigned) (sw - x)) {
+                x += run;
+                v = dsv_bs_get_neg(bs);
+                run = NEXT_RUN();
+                if (dsv_bs_ptr(bs) >= bufsz) {
+                    return;
                 }
+                outp[x++] = v;
             }
+            run -= sw - x;
             outp += w;
         }
-        for (l = 0; l < MAXLVL; l++) {
+        for (l = 0; l < nlvl; l++) {
             sw = dimat(l, w);
             sh = dimat(l, h);
             /* C.2.4 Higher Level Subband Dequantization */
@@ -503,16 +591,17 @@ hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_FMETA *fm)
                 o = subband(l, s, w, h);
                 outp = out + o;
                 for (y = 0; y < sh; y++) {
-                    for (x = 0; x < sw; x++) {
-                        if (!run--) {
-                            v = GETV(bs);
-                            run = (runs-- > 0) ? dsv_bs_get_ueg(bs) : INT_MAX;
-                            if (dsv_bs_ptr(bs) >= bufsz) {
-                                return;
-                            }
-                            outp[x] = v;
+                    x = 0;
+                    while (run < (unsigned) (sw - x)) {
+                        x += run;
+                        v = GETV(bs);
+                        run = NEXT_RUN();
+                        if (dsv_bs_ptr(bs) >= bufsz) {
+                            return;
                         }
+                        outp[x++] = v;
                     }
+                    run -= sw - x;
                     outp += w;
                 }
             }
@@ -520,19 +609,20 @@ hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_FMETA *fm)
     } else {
         /* C.2.3 LL Subband */
         for (y = 0; y < sh; y++) {
-            for (x = 0; x < sw; x++) {
-                if (!run--) {
-                    v = dsv_bs_get_neg(bs);
-                    run = (runs-- > 0) ? dsv_bs_get_ueg(bs) : INT_MAX;
-                    if (dsv_bs_ptr(bs) >= bufsz) {
-                        return;
-                    }
-                    outp[x] = dequantL(v, qp);
+            x = 0;
+            while (run < (unsigned) (sw - x)) {
+                x += run;
+                v = dsv_bs_get_neg(bs);
+                run = NEXT_RUN();
+                if (dsv_bs_ptr(bs) >= bufsz) {
+                    return;
                 }
+                outp[x++] = dequantL(v, qp);
             }
+            run -= sw - x;
             outp += w;
         }
-        for (l = 0; l < MAXLVL; l++) {
+        for (l = 0; l < nlvl; l++) {
             uint8_t *blockrow;
             DSV_SBC *parent;
 
@@ -540,41 +630,34 @@ hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_FMETA *fm)
             sh = dimat(l, h);
             dbx = (fm->params->nblocks_h << DSV_BLOCK_INTERP_P) / sw;
             dby = (fm->params->nblocks_v << DSV_BLOCK_INTERP_P) / sh;
-            qp = q;
             /* C.2.4 Higher Level Subband Dequantization */
             for (s = 1; s < NSUBBAND; s++) {
                 int par;
                 par = subband(l - 1, s, w, h);
                 o = subband(l, s, w, h);
-                qp = hfquant(fm, q, s, l);
+                fill_qmap(qmap, hfquant(fm, q, s, l), isP, l);
 
                 outp = out + o;
-                by = 0;
                 for (y = 0; y < sh; y++) {
-                    bx = 0;
-                    blockrow = fm->blockdata + (by >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
+                    /* block position is (x * nblocks) / sw in fixed point */
+                    blockrow = fm->blockdata + ((y * dby) >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
                     parent = out + par + ((y >> 1) * w);
-                    for (x = 0; x < sw; x++) {
-                        if (!run--) {
-                            int tmq = qp;
-                            int flags = blockrow[bx >> DSV_BLOCK_INTERP_P];
-                            int parc = parent[x >> 1];
-                            v = GETV(bs);
-                            run = (runs-- > 0) ? dsv_bs_get_ueg(bs) : INT_MAX;
-                            if (dsv_bs_ptr(bs) >= bufsz) {
-                                return;
-                            }
-                            if (isP) {
-                                TMQ4POS_P(tmq, flags);
-                            } else {
-                                TMQ4POS_I(tmq, flags, l);
-                            }
-                            outp[x] = dequantH(v, tmq);
+                    x = 0;
+                    while (run < (unsigned) (sw - x)) {
+                        int qi;
+
+                        x += run;
+                        qi = blockrow[(x * dbx) >> DSV_BLOCK_INTERP_P] << 1;
+                        qi |= (parent[x >> 1] != 0);
+                        v = GETV(bs);
+                        run = NEXT_RUN();
+                        if (dsv_bs_ptr(bs) >= bufsz) {
+                            return;
                         }
-                        bx += dbx;
+                        outp[x++] = dequantH(v, qmap[qi]);
                     }
+                    run -= sw - x;
                     outp += w;
-                    by += dby;
                 }
             }
         }
@@ -624,21 +707,28 @@ dsv_decode_plane(DSV_BS *bs, DSV_COEFS *dst, int q, DSV_FMETA *fm)
     plen = dsv_bs_get_bits(bs, 32);
 
     dsv_bs_align(bs);
-    if (plen > 0 && plen < (dst->width * dst->height * sizeof(DSV_SBC) * 2)) {
+    if (dsv_bs_error(bs) || dsv_bs_ptr(bs) > bs->end || plen > bs->end - dsv_bs_ptr(bs)) {
+        DSV_ERROR(("plane length exceeds packet: %u", plen));
+        bs->err = 1;
+        success = 0;
+    } else if (plen > 0 && plen < (dst->width * dst->height * sizeof(DSV_SBC) * 2)) {
         DSV_SBC LL;
         unsigned start = dsv_bs_ptr(bs);
+        unsigned end = bs->end;
 
+        bs->end = start + plen; /* nothing of this plane lies past its length */
         LL = dsv_bs_get_seg(bs);
         hzcc_dec(bs, start + plen, dst, q, fm);
         dst->data[0] = LL;
 
-        /* error detection */
-        if (dsv_bs_get_bits(bs, 8) != EOP_SYMBOL) {
+        /* error detection, a reduced resolution decode stops short of it */
+        if (!fm->lowres && dsv_bs_get_bits(bs, 8) != EOP_SYMBOL) {
             DSV_ERROR(("bad eop, frame data incomplete and/or corrupt"));
             success = 0;
         }
         dsv_bs_align(bs);
 
+        bs->end = end;
         dsv_bs_set(bs, start);
         dsv_bs_skip(bs, plen);
     } else {
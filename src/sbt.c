@@ -57,25 +57,63 @@
  * blurry and sharp and should be preserved and emphasized as much as possible.
  */
 
-static DSV_SBC *temp_buf = NULL;
-static int temp_bufsz = 0;
+/* vertical passes are run over strips of this many adjacent columns
+ * (one 64 byte cache line of coefficients). each strip is gathered into
+ * contiguous lines so the column filters read sequential memory rather
+ * than touching a new cache line for every sample */
+#define STRIP_W 16
 
-static void
-alloc_temp(int size)
+/* plane sized scratch followed by the two strip buffers */
+#define SCRATCH_SIZE(w, h) (((w) + 2) * ((h) + 2) + 2 * STRIP_W * (h))
+
+static DSV_SBC *
+alloc_temp(DSV_SBT_SCRATCH *s, int size)
 {
-    if (temp_bufsz < size) {
-        temp_bufsz = size;
+    if (s->size < size) {
+        s->size = size;
 
-        if (temp_buf) {
-            dsv_free(temp_buf);
-            temp_buf = NULL;
+        if (s->data) {
+            dsv_free(s->data);
+            s->data = NULL;
         }
 
-        temp_buf = dsv_alloc(temp_bufsz * sizeof(DSV_SBC));
-        if (temp_buf == NULL) {
+        s->data = dsv_alloc_nozero(s->mem, s->size * sizeof(DSV_SBC));
+        if (s->data == NULL) {
             DSV_ERROR(("out of memory"));
         }
     }
+    return s->data;
+}
+
+extern DSV_SBT_SCRATCH *
+dsv_sbt_new_scratch(DSV_MEMORY *mem)
+{
+    DSV_SBT_SCRATCH *s;
+
+    s = dsv_alloc(mem, sizeof(DSV_SBT_SCRATCH));
+    if (s) {
+        s->mem = mem;
+    }
+    return s;
+}
+
+/* reserve enough scratch to transform a plane of (up to) width x height */
+extern void
+dsv_sbt_alloc_scratch(DSV_SBT_SCRATCH *s, int width, int height)
+{
+    alloc_temp(s, SCRATCH_SIZE(width, height));
+}
+
+extern void
+dsv_sbt_free_scratch(DSV_SBT_SCRATCH *s)
+{
+    if (s == NULL) {
+        return;
+    }
+    if (s->data) {
+        dsv_free(s->data);
+    }
+    dsv_free(s);
 }
 
 static void
@@ -89,6 +127,32 @@ cpysub(DSV_SBC *dst, DSV_SBC *src, unsigned w, unsigned h, unsigned stride)
     }
 }
 
+static void
+get_strip(DSV_SBC *strip, DSV_SBC *src, int nc, int n, int stride)
+{
+    int x, y;
+
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < nc; x++) {
+            strip[x * n + y] = src[x];
+        }
+        src += stride;
+    }
+}
+
+static void
+put_strip(DSV_SBC *dst, DSV_SBC *strip, int nc, int n, int stride)
+{
+    int x, y;
+
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < nc; x++) {
+            dst[x] = strip[x * n + y];
+        }
+        dst += stride;
+    }
+}
+
 /* C.3 Rounding Divisions */
 static int
 round2(int v)
@@ -146,6 +210,8 @@ reflect(int i, int n)
 
 /* reflected get */
 #define rg(x, s) reflect(x, (n - 1)) * s
+/* direct get, for taps known to lie inside the signal */
+#define dg(x, s) (x) * s
 
 /* scaling + reordering coefficients from LHLHLHLH to LLLLHHHH */
 #define SCALE_PACK(scaleL, scaleH, s)                 \
@@ -213,28 +279,47 @@ reflect(int i, int n)
   }
 
 /* 5 tap low/high pass filters with/without adaptive ringing */
-#define MAKE_5_TAP(v, C0, CA, CS, op, s)            \
-  v[i * s] op (-v[rg(i - 3, s)] +                   \
+#define MAKE_5_TAP(v, C0, CA, CS, op, s, g)         \
+  v[i * s] op (-v[g(i - 3, s)] +                    \
           C0 * (v[(i - 1) * s] + v[(i + 1) * s]) -  \
-                v[rg(i + 3, s)] + CA) >> CS
+                v[g(i + 3, s)] + CA) >> CS
+
+/* only the outer taps can land outside the signal, so reflection
+ * is limited to the first and last few samples of the loop */
+#define DO_5_TAP_LO(v, C0, CA, CS, op, s)      \
+  v[0] op v[s] >> 1;                           \
+  for (i = 2; i < even_n && i < 4; i += 2) {   \
+      MAKE_5_TAP(v, C0, CA, CS, op, s, rg);    \
+  }                                            \
+  for (; i < n - 4; i += 2) {                  \
+      MAKE_5_TAP(v, C0, CA, CS, op, s, dg);    \
+  }                                            \
+  for (; i < even_n; i += 2) {                 \
+      MAKE_5_TAP(v, C0, CA, CS, op, s, rg);    \
+  }
 
-#define DO_5_TAP_LO(v, C0, CA, CS, op, s) \
-  v[0] op v[s] >> 1;                      \
-  for (i = 2; i < even_n; i += 2) {       \
-      MAKE_5_TAP(v, C0, CA, CS, op, s);   \
+#define ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, g)  \
+  {                                                       \
+      int bv = sb[(sbp >> DSV_BLOCK_INTERP_P) * sbs];     \
+      if (bv & DSV_IS_RINGING) {                          \
+          MAKE_5_TAP(v, R0, RA, RS, op, s, g);            \
+      } else {                                            \
+          MAKE_5_TAP(v, C0, CA, CS, op, s, g);            \
+      }                                                   \
+      sbp += delta;                                       \
   }
 
-#define DO_5_TAP_LO_A(v, C0, CA, CS, R0, RA, RS, op, s)             \
-  delta *= 2;                                                       \
-  v[0] op v[s] >> 1;                                                \
-  for (i = 2; i < even_n; i += 2) {                                 \
-      int bv = sb[(sbp >> DSV_BLOCK_INTERP_P) * sbs];               \
-      if (bv & DSV_IS_RINGING) {                                    \
-          MAKE_5_TAP(v, R0, RA, RS, op, s);                         \
-      } else {                                                      \
-          MAKE_5_TAP(v, C0, CA, CS, op, s);                         \
-      }                                                             \
-      sbp += delta;                                                 \
+#define DO_5_TAP_LO_A(v, C0, CA, CS, R0, RA, RS, op, s)       \
+  delta *= 2;                                                 \
+  v[0] op v[s] >> 1;                                          \
+  for (i = 2; i < even_n && i < 4; i += 2) {                  \
+      ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, rg);      \
+  }                                                           \
+  for (; i < n - 4; i += 2) {                                 \
+      ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, dg);      \
+  }                                                           \
+  for (; i < even_n; i += 2) {                                \
+      ADAPT_5_TAP(v, C0, CA, CS, R0, RA, RS, op, s, rg);      \
   }
 
 /* Filter coefficients for this encoder's ASF analysis implementation.
@@ -257,23 +342,23 @@ reflect(int i, int n)
 
 #define ASFNORM 6
 
-#define ASF93_LO(i, vs, s) \
-                  (LPFA *  vs[rg(i + 0, s)] \
-                 + LPFB * (vs[rg(i - 1, s)] + vs[rg(i + 1, s)]) \
-                 - LPFC * (vs[rg(i - 2, s)] + vs[rg(i + 2, s)])\
-                 - LPFD * (vs[rg(i - 3, s)] + vs[rg(i + 3, s)])\
-                 + LPFE * (vs[rg(i - 4, s)] + vs[rg(i + 4, s)]))
+#define ASF93_LO(i, vs, s, g) \
+                  (LPFA *  vs[g(i + 0, s)] \
+                 + LPFB * (vs[g(i - 1, s)] + vs[g(i + 1, s)]) \
+                 - LPFC * (vs[g(i - 2, s)] + vs[g(i + 2, s)])\
+                 - LPFD * (vs[g(i - 3, s)] + vs[g(i + 3, s)])\
+                 + LPFE * (vs[g(i - 4, s)] + vs[g(i + 4, s)]))
 
-#define ASF93_LO_R(i, vs, s) \
-                  (LPFAR *  vs[rg(i + 0, s)] \
-                 + LPFBR * (vs[rg(i - 1, s)] + vs[rg(i + 1, s)]) \
-                 - LPFCR * (vs[rg(i - 2, s)] + vs[rg(i + 2, s)])\
-                 - LPFDR * (vs[rg(i - 3, s)] + vs[rg(i + 3, s)])\
-                 + LPFER * (vs[rg(i - 4, s)] + vs[rg(i + 4, s)]))
+#define ASF93_LO_R(i, vs, s, g) \
+                  (LPFAR *  vs[g(i + 0, s)] \
+                 + LPFBR * (vs[g(i - 1, s)] + vs[g(i + 1, s)]) \
+                 - LPFCR * (vs[g(i - 2, s)] + vs[g(i + 2, s)])\
+                 - LPFDR * (vs[g(i - 3, s)] + vs[g(i + 3, s)])\
+                 + LPFER * (vs[g(i - 4, s)] + vs[g(i + 4, s)]))
 
-#define ASF93_HI(i, vs, s)\
-                  (HPFA *  vs[rg(i + 0, s)] \
-                 - HPFB * (vs[rg(i - 1, s)] + vs[rg(i + 1, s)]))
+#define ASF93_HI(i, vs, s, g)\
+                  (HPFA *  vs[g(i + 0, s)] \
+                 - HPFB * (vs[g(i - 1, s)] + vs[g(i + 1, s)]))
 
 static void
 filterLLI(DSV_SBC *out, DSV_SBC *in, int n, int s)
@@ -381,6 +466,20 @@ ifilterL2_a(DSV_SBC *out, DSV_SBC *in, int n, int s, uint8_t *sb, int delta, int
     DO_SIMPLE_HI(out, +=, s);
 }
 
+#define ASF93_STEP(g)                                              \
+  {                                                                \
+      int bv = sb[(sbp >> DSV_BLOCK_INTERP_P) * sbs];              \
+      if (bv & DSV_IS_RINGING) {                                   \
+          L = ASF93_LO_R((i - 1), in, s, g);                       \
+      } else {                                                     \
+          L = ASF93_LO((i - 1), in, s, g);                         \
+      }                                                            \
+      H = ASF93_HI((i - 0), in, s, dg);                            \
+      out[(i + 0) / 2 * s] = (L + (1 << (ASFNORM - 2))) >> (ASFNORM - 1); \
+      out[(i + n) / 2 * s] = (H + (1 << (ASFNORM - 4))) >> (ASFNORM - 3); \
+      sbp += delta;                                                \
+  }
+
 /* ASF93 asymmetric subband filter.
  *
  * 'n' is guaranteed to be even here because this is the highest freq subband
@@ -391,17 +490,16 @@ filterL1(DSV_SBC *out, DSV_SBC *in, int n, int s, uint8_t *sb, int delta, int sb
 {
     int i, L, H, sbp = 0;
     delta *= 2;
-    for (i = 1; i < n - 2; i += 2) {
-        int bv = sb[(sbp >> DSV_BLOCK_INTERP_P) * sbs];
-        if (bv & DSV_IS_RINGING) {
-            L = ASF93_LO_R((i - 1), in, s);
-        } else {
-            L = ASF93_LO((i - 1), in, s);
-        }
-        H = ASF93_HI((i - 0), in, s);
-        out[(i + 0) / 2 * s] = (L + (1 << (ASFNORM - 2))) >> (ASFNORM - 1);
-        out[(i + n) / 2 * s] = (H + (1 << (ASFNORM - 4))) >> (ASFNORM - 3);
-        sbp += delta;
+    /* the low pass reaches 4 samples either side of (i - 1), so only the
+     * first and last few outputs need reflected reads */
+    for (i = 1; i < n - 2 && i < 5; i += 2) {
+        ASF93_STEP(rg);
+    }
+    for (; i < n - 4; i += 2) {
+        ASF93_STEP(dg);
+    }
+    for (; i < n - 2; i += 2) {
+        ASF93_STEP(rg);
     }
     /* deal with edges */
     in[1 * s] -= (in[0 * s] + in[2 * s] + 1) >> 1;
@@ -446,35 +544,52 @@ ifilterLOSSLESS(DSV_SBC *out, DSV_SBC *in, int n, int s)
     DO_SIMPLE_HI(out, +=, s);
 }
 
-#define fwd_2d(tmp, in, fw, fh, lvl, filter) \
+#define fwd_2d(tmp, strip, in, fw, fh, lvl, filter) \
 { \
-    int i, j, sw, sh; \
+    int i, j, k, nc, sw, sh; \
+    DSV_SBC *cin, *cout; \
     sw = DSV_ROUND_SHIFT(fw, lvl - 1); \
     sh = DSV_ROUND_SHIFT(fh, lvl - 1); \
     for (j = 0; j < sh; j++) { \
         filter(tmp + fw * j, in + fw * j, sw, 1); \
     } \
-    for (i = 0; i < sw; i++) { \
-        filter(in + i, tmp + i, sh, fw); \
+    cin = strip; \
+    cout = strip + STRIP_W * sh; \
+    for (i = 0; i < sw; i += STRIP_W) { \
+        nc = MIN(STRIP_W, sw - i); \
+        get_strip(cin, tmp + i, nc, sh, fw); \
+        for (k = 0; k < nc; k++) { \
+            filter(cout + sh * k, cin + sh * k, sh, 1); \
+        } \
+        put_strip(in + i, cout, nc, sh, fw); \
     } \
 }
 
-#define inv_2d(tmp, in, fw, fh, lvl, ifilter) \
+#define inv_2d(tmp, strip, in, fw, fh, lvl, ifilter) \
 { \
-    int i, j, sw, sh; \
+    int i, j, k, nc, sw, sh; \
+    DSV_SBC *cin, *cout; \
     sw = DSV_ROUND_SHIFT(fw, lvl - 1); \
     sh = DSV_ROUND_SHIFT(fh, lvl - 1); \
-    for (i = 0; i < sw; i++) { \
-        ifilter(tmp + i, in + i, sh, fw); \
+    cin = strip; \
+    cout = strip + STRIP_W * sh; \
+    for (i = 0; i < sw; i += STRIP_W) { \
+        nc = MIN(STRIP_W, sw - i); \
+        get_strip(cin, in + i, nc, sh, fw); \
+        for (k = 0; k < nc; k++) { \
+            ifilter(cout + sh * k, cin + sh * k, sh, 1); \
+        } \
+        put_strip(tmp + i, cout, nc, sh, fw); \
     } \
     for (j = 0; j < sh; j++) { \
         ifilter(in + fw * j, tmp + fw * j, sw, 1); \
     } \
 }
 static void
-fwd_L1a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
+fwd_L1a_2d(DSV_SBC *tmp, DSV_SBC *strip, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
 {
-    int i, j, bx = 0, by = 0, dbx, dby, w, h;
+    int i, j, k, nc, bx = 0, by = 0, dbx, dby, w, h;
+    DSV_SBC *cin, *cout;
     uint8_t *line;
 
     w = DSV_ROUND_SHIFT(sW, lvl - 1);
@@ -488,18 +603,26 @@ fwd_L1a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
         filterL1(tmp + sW * j, in + sW * j, w, 1, line, dbx, 1);
         by += dby;
     }
-    for (i = 0; i < w; i++) {
-        line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
-        filterL1(in + i, tmp + i, h, sW, line, dby, fm->params->nblocks_h);
-        bx += dbx;
+    cin = strip;
+    cout = strip + STRIP_W * h;
+    for (i = 0; i < w; i += STRIP_W) {
+        nc = MIN(STRIP_W, w - i);
+        get_strip(cin, tmp + i, nc, h, sW);
+        for (k = 0; k < nc; k++) {
+            line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
+            filterL1(cout + h * k, cin + h * k, h, 1, line, dby, fm->params->nblocks_h);
+            bx += dbx;
+        }
+        put_strip(in + i, cout, nc, h, sW);
     }
 }
 
 /* adaptive */
 static void
-fwd_L2a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
+fwd_L2a_2d(DSV_SBC *tmp, DSV_SBC *strip, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
 {
-    int i, j, bx = 0, by = 0, dbx, dby, w, h;
+    int i, j, k, nc, bx = 0, by = 0, dbx, dby, w, h;
+    DSV_SBC *cin, *cout;
     uint8_t *line;
 
     w = DSV_ROUND_SHIFT(sW, lvl - 1);
@@ -513,17 +636,25 @@ fwd_L2a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
         filterL2_a(tmp + sW * j, in + sW * j, w, 1, line, dbx, 1);
         by += dby;
     }
-    for (i = 0; i < w; i++) {
-        line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
-        filterL2_a(in + i, tmp + i, h, sW, line, dby, fm->params->nblocks_h);
-        bx += dbx;
+    cin = strip;
+    cout = strip + STRIP_W * h;
+    for (i = 0; i < w; i += STRIP_W) {
+        nc = MIN(STRIP_W, w - i);
+        get_strip(cin, tmp + i, nc, h, sW);
+        for (k = 0; k < nc; k++) {
+            line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
+            filterL2_a(cout + h * k, cin + h * k, h, 1, line, dby, fm->params->nblocks_h);
+            bx += dbx;
+        }
+        put_strip(in + i, cout, nc, h, sW);
     }
 }
 
 static void
-inv_L2a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
+inv_L2a_2d(DSV_SBC *tmp, DSV_SBC *strip, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
 {
-    int i, j, bx = 0, by = 0, dbx, dby, w, h;
+    int i, j, k, nc, bx = 0, by = 0, dbx, dby, w, h;
+    DSV_SBC *cin, *cout;
     uint8_t *line;
 
     w = DSV_ROUND_SHIFT(sW, lvl - 1);
@@ -531,10 +662,17 @@ inv_L2a_2d(DSV_SBC *tmp, DSV_SBC *in, int sW, int sH, int lvl, DSV_FMETA *fm)
 
     dbx = (fm->params->nblocks_h << DSV_BLOCK_INTERP_P) / w;
     dby = (fm->params->nblocks_v << DSV_BLOCK_INTERP_P) / h;
-    for (i = 0; i < w; i++) {
-        line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
-        ifilterL2_a(tmp + i, in + i, h, sW, line, dby, fm->params->nblocks_h);
-        bx += dbx;
+    cin = strip;
+    cout = strip + STRIP_W * h;
+    for (i = 0; i < w; i += STRIP_W) {
+        nc = MIN(STRIP_W, w - i);
+        get_strip(cin, in + i, nc, h, sW);
+        for (k = 0; k < nc; k++) {
+            line = fm->blockdata + (bx >> DSV_BLOCK_INTERP_P);
+            ifilterL2_a(cout + h * k, cin + h * k, h, 1, line, dby, fm->params->nblocks_h);
+            bx += dbx;
+        }
+        put_strip(tmp + i, cout, nc, h, sW);
     }
     for (j = 0; j < h; j++) {
         line = fm->blockdata + (by >> DSV_BLOCK_INTERP_P) * fm->params->nblocks_h;
@@ -810,6 +948,11 @@ p2sbc(DSV_COEFS *dc, DSV_PLANE *p)
         }
         d += dc->width;
     }
+    /* coef planes are rounded up to even dimensions, the extra row of an
+     * odd height chroma plane is transformed as zero */
+    if (dc->height > p->h) {
+        memset(d, 0, (dc->height - p->h) * dc->width * sizeof(DSV_SBC));
+    }
 }
 
 /* C.3.3 Subband Recomposition */
@@ -830,6 +973,32 @@ sbc2p(DSV_PLANE *p, DSV_COEFS *dc)
     }
 }
 
+/* recomposition stopped 'lowres' levels early, the top left corner of the
+ * coefficients holds the picture at 1/2^lowres scale with a gain of 2^shift */
+static void
+sbc2p_lowres(DSV_PLANE *p, DSV_COEFS *dc, int lowres, int shift)
+{
+    int x, y, sw, sh;
+    DSV_SBC *d, v;
+
+    sw = DSV_ROUND_SHIFT(dc->width, lowres);
+    sh = DSV_ROUND_SHIFT(dc->height, lowres);
+    for (y = 0; y < p->h; y++) {
+        uint8_t *line = DSV_GET_LINE(p, y);
+
+        /* chroma planes can be one sample larger than their subband */
+        d = dc->data + MIN(y, sh - 1) * dc->width;
+        for (x = 0; x < p->w; x++) {
+            v = d[MIN(x, sw - 1)];
+            if (shift) {
+                v = DSV_SAR_R(v, shift);
+            }
+            v += 128;
+            line[x] = CLAMP(v, 0, 255);
+        }
+    }
+}
+
 /* C.3.3 Subband Recomposition - num_levels */
 static int
 nlevels(int w, int h)
@@ -848,7 +1017,7 @@ extern void
 dsv_fwd_sbt(DSV_PLANE *src, DSV_COEFS *dst, DSV_FMETA *fm)
 {
     int w, h, lvls, l, ovf_safety;
-    DSV_SBC *temp_buf_pad;
+    DSV_SBC *scratch, *temp_buf_pad, *strip;
 
     w = dst->width;
     h = dst->height;
@@ -856,29 +1025,30 @@ dsv_fwd_sbt(DSV_PLANE *src, DSV_COEFS *dst, DSV_FMETA *fm)
     p2sbc(dst, src);
 
     lvls = nlevels(w, h);
-    alloc_temp((w + 2) * (h + 2));
-    temp_buf_pad = temp_buf + w;
+    scratch = alloc_temp(fm->scratch, SCRATCH_SIZE(w, h));
+    temp_buf_pad = scratch + w;
+    strip = scratch + (w + 2) * (h + 2);
 
     for (l = 1; l <= lvls; l++) {
         ovf_safety = OVF_SAFETY_CONDITION;
         if (fm->params->lossless) {
             if ((l >= 1 && l <= (lvls - 2))) {
-                fwd_2d(temp_buf_pad, dst->data, w, h, l, filterLOSSLESS);
+                fwd_2d(temp_buf_pad, strip, dst->data, w, h, l, filterLOSSLESS);
             } else {
                 fwd(dst->data, temp_buf_pad, w, h, l, ovf_safety);
             }
             continue;
         }
         if (LLI_CONDITION) {
-            fwd_2d(temp_buf_pad, dst->data, w, h, l, filterLLI);
+            fwd_2d(temp_buf_pad, strip, dst->data, w, h, l, filterLLI);
         } else if (LLP_CONDITION) {
-            fwd_2d(temp_buf_pad, dst->data, w, h, l, filterLLP);
+            fwd_2d(temp_buf_pad, strip, dst->data, w, h, l, filterLLP);
         } else if (CC_CONDITION) {
-            fwd_2d(temp_buf_pad, dst->data, w, h, l, filterCC);
+            fwd_2d(temp_buf_pad, strip, dst->data, w, h, l, filterCC);
         } else if (L2A_CONDITION) {
-            fwd_L2a_2d(temp_buf_pad, dst->data, w, h, l, fm);
+            fwd_L2a_2d(temp_buf_pad, strip, dst->data, w, h, l, fm);
         } else if (L1_CONDITION) {
-            fwd_L1a_2d(temp_buf_pad, dst->data, w, h, l, fm);
+            fwd_L1a_2d(temp_buf_pad, strip, dst->data, w, h, l, fm);
         } else {
             fwd(dst->data, temp_buf_pad, w, h, l, ovf_safety);
         }
@@ -890,37 +1060,38 @@ extern void
 dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, DSV_FMETA *fm)
 {
     int w, h, lvls, l, hqp, ovf_safety;
-    DSV_SBC *temp_buf_pad;
+    DSV_SBC *scratch, *temp_buf_pad, *strip;
 
     w = src->width;
     h = src->height;
 
     lvls = nlevels(w, h);
-    alloc_temp((w + 2) * (h + 2));
-    temp_buf_pad = temp_buf + w;
+    scratch = alloc_temp(fm->scratch, SCRATCH_SIZE(w, h));
+    temp_buf_pad = scratch + w;
+    strip = scratch + (w + 2) * (h + 2);
 
-    for (l = lvls; l > 0; l--) {
+    for (l = lvls; l > fm->lowres; l--) {
         hqp = (fm->cur_plane == 0) ? (q / (fm->isP ? 14 : (l > 4 ? 2 : 8))) : (q / 2);
         ovf_safety = OVF_SAFETY_CONDITION;
 
         if (fm->params->lossless) {
             if ((l >= 1 && l <= (lvls - 2))) {
-                inv_2d(temp_buf_pad, src->data, w, h, l, ifilterLOSSLESS);
+                inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterLOSSLESS);
             } else {
                 inv_simple(src->data, temp_buf_pad, w, h, l, ovf_safety);
             }
             continue;
         }
         if (LLI_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterLLI);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterLLI);
         } else if (LLP_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterLLP);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterLLP);
         } else if (CC_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterCC);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterCC);
         } else if (L2A_CONDITION) {
-            inv_L2a_2d(temp_buf_pad, src->data, w, h, l, fm);
+            inv_L2a_2d(temp_buf_pad, strip, src->data, w, h, l, fm);
         } else if (L1_CONDITION) {
-            inv_2d(temp_buf_pad, src->data, w, h, l, ifilterL1);
+            inv_2d(temp_buf_pad, strip, src->data, w, h, l, ifilterL1);
         } else {
             if (fm->cur_plane == 0 || !fm->isP) {
                 inv(src->data, temp_buf_pad, w, h, l, hqp, ovf_safety);
@@ -930,5 +1101,18 @@ dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, DSV_FMETA *fm)
         }
     }
 
-    sbc2p(dst, src);
+    if (fm->lowres) {
+        int shift = 0;
+
+        /* every level left out scales the LL band by 4, except the
+         * lossless lifting levels which keep its range */
+        for (l = 1; l <= fm->lowres; l++) {
+            if (!fm->params->lossless || l > (lvls - 2)) {
+                shift += 2;
+            }
+        }
+        sbc2p_lowres(dst, src, fm->lowres, shift);
+    } else {
+        sbc2p(dst, src);
+    }
 }
@@ -14,8 +14,56 @@
  */
 /*****************************************************************************/
 
+/* mmap based input where available, stdio everywhere else */
+#ifndef DSV_HAVE_MMAP
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__wasi__)
+#define DSV_HAVE_MMAP 1
+#else
+#define DSV_HAVE_MMAP 0
+#endif
+#endif
+
+/* fseeko/ftello with a 64 bit off_t for streams past 2 GB */
+#ifndef DSV_HAVE_FSEEKO
+#define DSV_HAVE_FSEEKO DSV_HAVE_MMAP
+#endif
+
+/* fsync to push flushed output through to the disk */
+#ifndef DSV_HAVE_FSYNC
+#define DSV_HAVE_FSYNC DSV_HAVE_MMAP
+#endif
+
+#if (DSV_HAVE_MMAP || DSV_HAVE_FSEEKO || DSV_HAVE_FSYNC) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#if DSV_HAVE_FSEEKO && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+#if DSV_HAVE_MMAP && defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
+#endif
+
 #include "util.h"
 #include "dsv_encoder.h"
+#include "dsv_internal.h"
+
+#include <limits.h>
+
+#if DSV_HAVE_FSEEKO
+#include <sys/types.h>
+#endif
+#if DSV_HAVE_FSYNC
+#include <unistd.h>
+#include <errno.h>
+#endif
+#if DSV_HAVE_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 /* totally based on heuristics */
 extern unsigned
@@ -95,43 +143,45 @@ conv444to422(DSV_PLANE *srcf, DSV_PLANE *dstf)
     }
 }
 
+/* the vertical conversions go row by row, walking down columns
+ * touches a new cache line for every pixel */
 extern void
 conv422to420(DSV_PLANE *srcf, DSV_PLANE *dstf)
 {
-    int i, j, w, h, n, s;
-    uint8_t *src, *dst;
+    int i, j, w, h, n;
+    uint8_t *s0, *s1, *dst;
 
     w = srcf->w;
     h = srcf->h;
-    src = srcf->data;
     dst = dstf->data;
-    s = srcf->stride;
-    for (i = 0; i < w; i++) {
-        for (j = 0; j < h; j += 2) {
-            n = (j < h - 1) ? j + 1 : h - 1;
-            dst[dstf->stride * (j >> 1)] = (src[s * j] + src[s * n] + 1) >> 1;
+    for (j = 0; j < h; j += 2) {
+        n = (j < h - 1) ? j + 1 : h - 1;
+        s0 = srcf->data + srcf->stride * j;
+        s1 = srcf->data + srcf->stride * n;
+        for (i = 0; i < w; i++) {
+            dst[i] = (s0[i] + s1[i] + 1) >> 1;
         }
-        src++;
-        dst++;
+        dst += dstf->stride;
     }
 }
 
 extern void
 conv411to420(DSV_PLANE *srcf, DSV_PLANE *dstf)
 {
-    int i, j, w, h, n, s;
-    uint8_t *src, *dst;
+    int i, j, w, h, n;
+    uint8_t *s0, *s1, *dst;
 
     w = srcf->w;
     h = srcf->h;
-    src = srcf->data;
     dst = dstf->data;
-    s = srcf->stride;
-    for (i = 0; i < w * 2; i++) {
-        for (j = 0; j < h; j += 2) {
-            n = (j < h - 1) ? j + 1 : h - 1;
-            dst[i + dstf->stride * (j >> 1)] = (src[(i >> 1) + s * j] + src[(i >> 1) + s * n] + 1) >> 1;
+    for (j = 0; j < h; j += 2) {
+        n = (j < h - 1) ? j + 1 : h - 1;
+        s0 = srcf->data + srcf->stride * j;
+        s1 = srcf->data + srcf->stride * n;
+        for (i = 0; i < w * 2; i++) {
+            dst[i] = (s0[i >> 1] + s1[i >> 1] + 1) >> 1;
         }
+        dst += dstf->stride;
     }
 }
 
@@ -486,3 +536,300 @@ dsv_y4m_write_frame_hdr(FILE *out)
     char *fh = "FRAME\n";
     fwrite(fh, 1, strlen(fh), out);
 }
+
+#if DSV_HAVE_MMAP
+/* picture data bytes per frame, 0 for packed formats */
+static size_t
+planar_frame_size(int w, int h, int subsamp)
+{
+    size_t npix = w * h;
+
+    switch (subsamp) {
+        case DSV_SUBSAMP_444:
+            return npix * 3;
+        case DSV_SUBSAMP_422:
+            return npix + 2 * ((w / 2) * h);
+        case DSV_SUBSAMP_420:
+        case DSV_SUBSAMP_411:
+            return npix + 2 * (npix / 4);
+        case DSV_SUBSAMP_410:
+            return npix + 2 * (npix / 16);
+        default:
+            break;
+    }
+    return 0;
+}
+
+/* frame headers are "FRAME" followed by optional parameters and a newline.
+ * the parameters are skipped, nothing in them changes the picture layout */
+#define Y4M_MAX_FRAME_HDR 256
+
+/* finds the frame data after the header at 'pos', 0 if there is none */
+static size_t
+y4m_frame_data(DSV_INPUT_MAP *m, size_t pos)
+{
+    size_t i, end;
+
+    if (pos + 5 > m->size || memcmp(m->base + pos, "FRAME", 5) != 0) {
+        return 0;
+    }
+    end = MIN(m->size, pos + Y4M_MAX_FRAME_HDR);
+    for (i = pos + 5; i < end; i++) {
+        if (m->base[i] == '\n') {
+            if (i + 1 + m->framesz > m->size) {
+                return 0;
+            }
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static int
+index_y4m(DSV_INPUT_MAP *m)
+{
+    size_t pos, data;
+    int n = 0;
+
+    /* count first, then fill */
+    pos = m->start;
+    while ((data = y4m_frame_data(m, pos)) != 0) {
+        pos = data + m->framesz;
+        n++;
+    }
+    if (pos != m->size) {
+        DSV_WARNING(("ignoring %u bytes after the last complete Y4M frame", (unsigned) (m->size - pos)));
+    }
+    m->nframes = n;
+    if (n == 0) {
+        return 1;
+    }
+    m->index = dsv_alloc_nozero(NULL, n * sizeof(size_t));
+    if (m->index == NULL) {
+        return 0;
+    }
+    pos = m->start;
+    for (n = 0; n < m->nframes; n++) {
+        m->index[n] = y4m_frame_data(m, pos);
+        pos = m->index[n] + m->framesz;
+    }
+    return 1;
+}
+
+extern int
+dsv_input_map(DSV_INPUT_MAP *m, FILE *in, size_t start, int y4m, int w, int h, int subsamp)
+{
+    struct stat st;
+    void *p;
+    int fd, hs, vs;
+
+    memset(m, 0, sizeof(*m));
+    m->framesz = planar_frame_size(w, h, subsamp);
+    if (m->framesz == 0 || in == NULL) {
+        return 0;
+    }
+    /* frames in the file have their chroma sizes rounded down while
+     * dsv_load_planar_frame rounds them up. the stdio readers fill a padded
+     * buffer, a mapping has no such slack, so only map exact sizes */
+    hs = DSV_FORMAT_H_SHIFT(subsamp);
+    vs = DSV_FORMAT_V_SHIFT(subsamp);
+    if ((w & ((1 << hs) - 1)) || (h & ((1 << vs) - 1))) {
+        return 0;
+    }
+    fd = fileno(in);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size <= 0 || (size_t) st.st_size < start) {
+        return 0; /* pipes and such */
+    }
+    /* a 64 bit off_t can describe files a 32 bit address space can't map */
+    if ((off_t) (size_t) st.st_size != st.st_size) {
+        return 0;
+    }
+    p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+    m->base = p;
+    m->size = (size_t) st.st_size;
+    m->start = start;
+    /* frames are read front to back, let the kernel read ahead */
+    posix_madvise(m->base, m->size, POSIX_MADV_SEQUENTIAL);
+    if (y4m) {
+        if (!index_y4m(m)) {
+            dsv_input_unmap(m);
+            return 0;
+        }
+    } else {
+        m->nframes = (m->size - start) / m->framesz;
+    }
+    return 1;
+}
+
+extern uint8_t *
+dsv_input_map_frame(DSV_INPUT_MAP *m, int fno)
+{
+    size_t off, next, pgsz;
+
+    if (fno < 0 || fno >= m->nframes) {
+        return NULL;
+    }
+    off = m->index ? m->index[fno] : m->start + fno * m->framesz;
+    if (fno + 1 < m->nframes) {
+        /* ask for the next frame while this one is being encoded */
+        next = m->index ? m->index[fno + 1] : off + m->framesz;
+        pgsz = sysconf(_SC_PAGESIZE);
+        next -= next % pgsz;
+        posix_madvise(m->base + next, MIN(m->size - next, m->framesz + pgsz), POSIX_MADV_WILLNEED);
+    }
+    return m->base + off;
+}
+
+extern size_t
+dsv_pipe_reserve(FILE *f, int nframes, int w, int h, int subsamp)
+{
+#ifdef F_SETPIPE_SZ
+    struct stat st;
+    size_t bytes;
+    int fd, got;
+
+    if (subsamp == DSV_SUBSAMP_UYVY) {
+        bytes = w * h * 2;
+    } else {
+        bytes = planar_frame_size(w, h, subsamp);
+    }
+    /* room for Y4M frame headers too */
+    bytes = (bytes + Y4M_MAX_FRAME_HDR) * nframes;
+    if (f == NULL || bytes == 0) {
+        return 0;
+    }
+    fd = fileno(f);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        return 0;
+    }
+    /* unprivileged processes are limited to /proc/sys/fs/pipe-max-size,
+     * settle for the largest size that is allowed */
+    bytes = MIN(bytes, (size_t) INT_MAX);
+    while ((got = fcntl(fd, F_SETPIPE_SZ, (int) bytes)) < 0) {
+        if (errno != EPERM || bytes <= 65536) {
+            return 0;
+        }
+        bytes /= 2;
+    }
+    return got;
+#else
+    (void) f;
+    (void) nframes;
+    (void) w;
+    (void) h;
+    (void) subsamp;
+    return 0;
+#endif
+}
+
+extern void
+dsv_input_unmap(DSV_INPUT_MAP *m)
+{
+    if (m->index) {
+        dsv_free(m->index);
+    }
+    if (m->base) {
+        munmap(m->base, m->size);
+    }
+    memset(m, 0, sizeof(*m));
+}
+#else
+extern int
+dsv_input_map(DSV_INPUT_MAP *m, FILE *in, size_t start, int y4m, int w, int h, int subsamp)
+{
+    (void) in;
+    (void) start;
+    (void) y4m;
+    (void) w;
+    (void) h;
+    (void) subsamp;
+    memset(m, 0, sizeof(*m));
+    return 0;
+}
+
+extern uint8_t *
+dsv_input_map_frame(DSV_INPUT_MAP *m, int fno)
+{
+    (void) m;
+    (void) fno;
+    return NULL;
+}
+
+extern size_t
+dsv_pipe_reserve(FILE *f, int nframes, int w, int h, int subsamp)
+{
+    (void) f;
+    (void) nframes;
+    (void) w;
+    (void) h;
+    (void) subsamp;
+    return 0;
+}
+
+extern void
+dsv_input_unmap(DSV_INPUT_MAP *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+#endif
+
+extern int
+dsv_file_seek(FILE *f, DSV_OFFSET pos)
+{
+    if (pos < 0) {
+        return -1;
+    }
+#if defined(_WIN32)
+    return _fseeki64(f, pos, SEEK_SET) ? -1 : 0;
+#elif DSV_HAVE_FSEEKO
+    if ((DSV_OFFSET) (off_t) pos != pos) {
+        return -1;
+    }
+    return fseeko(f, (off_t) pos, SEEK_SET) ? -1 : 0;
+#else
+    if (pos > LONG_MAX) {
+        return -1;
+    }
+    return fseek(f, (long) pos, SEEK_SET) ? -1 : 0;
+#endif
+}
+
+extern DSV_OFFSET
+dsv_file_size(FILE *f)
+{
+#if defined(_WIN32)
+    if (_fseeki64(f, 0, SEEK_END)) {
+        return -1;
+    }
+    return _ftelli64(f);
+#elif DSV_HAVE_FSEEKO
+    if (fseeko(f, 0, SEEK_END)) {
+        return -1;
+    }
+    return ftello(f);
+#else
+    if (fseek(f, 0, SEEK_END)) {
+        return -1;
+    }
+    return ftell(f);
+#endif
+}
+
+extern int
+dsv_file_sync(FILE *f)
+{
+    if (fflush(f) != 0) {
+        return -1;
+    }
+#if DSV_HAVE_FSYNC
+    /* pipes and terminals can't be synced, that is not an error */
+    if (fsync(fileno(f)) != 0 && errno != EINVAL && errno != EROFS) {
+        return -1;
+    }
+#endif
+    return 0;
+}
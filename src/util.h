@@ -46,6 +46,49 @@ extern int dsv_y4m_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp);
 extern void dsv_y4m_write_hdr(FILE *out, int w, int h, int subsamp, int fpsn, int fpsd, int aspn, int aspd);
 extern void dsv_y4m_write_frame_hdr(FILE *out);
 
+/* memory mapped input.
+ *
+ * maps a whole raw YUV or Y4M file and indexes its frames once so any frame
+ * can be handed to the encoder straight out of the mapping without being
+ * read or copied first. only possible for regular files on platforms with
+ * mmap, anything else (pipes, UYVY input) has to use the stdio readers.
+ */
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t start; /* offset of the first frame's picture data (raw YUV) */
+    size_t framesz; /* bytes of picture data per frame */
+    size_t *index; /* offset of every frame's picture data (Y4M) */
+    int nframes;
+} DSV_INPUT_MAP;
+
+/* 'start' is where the first frame header / frame begins.
+ * returns 1 if the file was mapped, 0 if the stdio readers must be used */
+extern int dsv_input_map(DSV_INPUT_MAP *m, FILE *in, size_t start, int y4m, int w, int h, int subsamp);
+/* returns a pointer to the planar picture data of frame 'fno',
+ * NULL past the end of the file */
+extern uint8_t *dsv_input_map_frame(DSV_INPUT_MAP *m, int fno);
+extern void dsv_input_unmap(DSV_INPUT_MAP *m);
+
+/* if 'f' is a pipe, grow it to hold 'nframes' frames so the process on the
+ * other end (producing our input or consuming our output) can run that far
+ * ahead / behind instead of stalling on every frame.
+ * returns the new pipe size, 0 if it could not be changed */
+extern size_t dsv_pipe_reserve(FILE *f, int nframes, int w, int h, int subsamp);
+
+/* file positioning that is not limited to the 2 GB of a 32 bit long.
+ * uses _fseeki64 on Windows and fseeko with a 64 bit off_t on POSIX
+ * systems. elsewhere it falls back to fseek/ftell and offsets past
+ * LONG_MAX fail instead of wrapping.
+ * dsv_file_seek returns 0 on success, dsv_file_size leaves the file
+ * positioned at its end and returns its size, both return -1 on failure */
+extern int dsv_file_seek(FILE *f, DSV_OFFSET pos);
+extern DSV_OFFSET dsv_file_size(FILE *f);
+
+/* flushes 'f' and, where fsync is available (DSV_HAVE_FSYNC), has the
+ * system write it through to the disk. returns 0 on success */
+extern int dsv_file_sync(FILE *f);
+
 #ifdef __cplusplus
 }
 #endif